@@ -0,0 +1,246 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Bitboard move generation for the Othello engines.
+ *
+ *	A position is stored as two 64-bit masks, one for the side to move
+ *	(player) and one for the other side (opponent). Square n is bit n,
+ *	where n = 8 * row + col and row/col are the digits used by the
+ *	server protocol, so "00" is bit 0 and "77" is bit 63.
+ *
+ *	Moves and flips are computed for all eight directions at once with
+ *	parallel-prefix (Kogge-Stone) shifts instead of walking the board
+ *	square by square. get_flips_batch() does the same for several moves
+ *	of one position, four at a time in AVX2 registers when the compiler
+ *	targets AVX2 (-march=native) and one at a time otherwise.
+ *H***********************************************************************/
+
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include<stdint.h>
+#ifdef __AVX2__
+#include<immintrin.h>
+#endif
+
+/* Columns 1..6; stops horizontal and diagonal runs wrapping between rows */
+#define NOT_EDGE_COLS 0x7E7E7E7E7E7E7E7EULL
+
+#define SQUARE(row, col) (8 * (row) + (col))
+#define BIT(sq) (1ULL << (sq))
+
+struct Position {
+	uint64_t player;	/* discs of the side to move */
+	uint64_t opponent;	/* discs of the other side */
+	int colour;			/* colour of the side to move, 1 or 2 */
+};
+
+static inline int popcount(uint64_t b) {
+	return __builtin_popcountll(b);
+}
+
+/* Index of the lowest set bit; b must not be 0 */
+static inline int first_square(uint64_t b) {
+	return __builtin_ctzll(b);
+}
+
+/*
+	Squares reachable from P over a run of discs in mask, in the direction
+	of +dir and -dir. Runs are at most six discs long so two single steps
+	and two double steps cover them.
+ */
+static inline uint64_t moves_dir(uint64_t P, uint64_t mask, int dir) {
+	uint64_t flip_l, flip_r, mask_l, mask_r;
+	int dir2 = dir + dir;
+
+	flip_l  = mask & (P << dir);			flip_r  = mask & (P >> dir);
+	flip_l |= mask & (flip_l << dir);		flip_r |= mask & (flip_r >> dir);
+	mask_l  = mask & (mask << dir);			mask_r  = mask_l >> dir;
+	flip_l |= mask_l & (flip_l << dir2);	flip_r |= mask_r & (flip_r >> dir2);
+	flip_l |= mask_l & (flip_l << dir2);	flip_r |= mask_r & (flip_r >> dir2);
+
+	return (flip_l << dir) | (flip_r >> dir);
+}
+
+/* All legal moves for P against O as a mask of empty squares */
+static inline uint64_t get_moves(uint64_t P, uint64_t O) {
+	uint64_t mask = O & NOT_EDGE_COLS;
+
+	return (moves_dir(P, mask, 1)
+		| moves_dir(P, O, 8)
+		| moves_dir(P, mask, 7)
+		| moves_dir(P, mask, 9)) & ~(P | O);
+}
+
+/*
+	Discs flipped along +dir and -dir when P plays the square x. Same prefix
+	trick as moves_dir but started from the move, and a run only counts if
+	it is closed off by one of P's discs.
+ */
+static inline uint64_t flips_dir(uint64_t x, uint64_t P, uint64_t mask, int dir) {
+	uint64_t flip_l, flip_r, mask_l, mask_r, flips = 0;
+	int dir2 = dir + dir;
+
+	flip_l  = mask & (x << dir);			flip_r  = mask & (x >> dir);
+	flip_l |= mask & (flip_l << dir);		flip_r |= mask & (flip_r >> dir);
+	mask_l  = mask & (mask << dir);			mask_r  = mask_l >> dir;
+	flip_l |= mask_l & (flip_l << dir2);	flip_r |= mask_r & (flip_r >> dir2);
+	flip_l |= mask_l & (flip_l << dir2);	flip_r |= mask_r & (flip_r >> dir2);
+
+	if ((flip_l << dir) & P) flips |= flip_l;
+	if ((flip_r >> dir) & P) flips |= flip_r;
+	return flips;
+}
+
+/* Discs flipped when P plays sq; 0 means the move is illegal */
+static inline uint64_t get_flips(int sq, uint64_t P, uint64_t O) {
+	uint64_t x = BIT(sq);
+	uint64_t mask = O & NOT_EDGE_COLS;
+
+	return flips_dir(x, P, mask, 1)
+		| flips_dir(x, P, O, 8)
+		| flips_dir(x, P, mask, 7)
+		| flips_dir(x, P, mask, 9);
+}
+
+#ifdef __AVX2__
+/* flips_dir() for four moves at once, one per 64-bit lane */
+static inline __m256i flips_dir4(__m256i x, __m256i P, __m256i mask, int dir) {
+	__m256i flip_l, flip_r, mask_l, mask_r, closed_l, closed_r;
+	const __m256i zero = _mm256_setzero_si256();
+	int dir2 = dir + dir;
+
+	flip_l = _mm256_and_si256(mask, _mm256_slli_epi64(x, dir));
+	flip_r = _mm256_and_si256(mask, _mm256_srli_epi64(x, dir));
+	flip_l = _mm256_or_si256(flip_l, _mm256_and_si256(mask, _mm256_slli_epi64(flip_l, dir)));
+	flip_r = _mm256_or_si256(flip_r, _mm256_and_si256(mask, _mm256_srli_epi64(flip_r, dir)));
+	mask_l = _mm256_and_si256(mask, _mm256_slli_epi64(mask, dir));
+	mask_r = _mm256_srli_epi64(mask_l, dir);
+	flip_l = _mm256_or_si256(flip_l, _mm256_and_si256(mask_l, _mm256_slli_epi64(flip_l, dir2)));
+	flip_r = _mm256_or_si256(flip_r, _mm256_and_si256(mask_r, _mm256_srli_epi64(flip_r, dir2)));
+	flip_l = _mm256_or_si256(flip_l, _mm256_and_si256(mask_l, _mm256_slli_epi64(flip_l, dir2)));
+	flip_r = _mm256_or_si256(flip_r, _mm256_and_si256(mask_r, _mm256_srli_epi64(flip_r, dir2)));
+
+	// A run only counts where the next square along is P's; all ones there
+	closed_l = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_slli_epi64(flip_l, dir), P), zero);
+	closed_r = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_srli_epi64(flip_r, dir), P), zero);
+	return _mm256_or_si256(_mm256_andnot_si256(closed_l, flip_l), _mm256_andnot_si256(closed_r, flip_r));
+}
+#endif
+
+/*
+	get_flips() for each of the n squares in sq, which must all be legal
+	moves (or at least empty) for P.
+ */
+static inline void get_flips_batch(const int *sq, int n, uint64_t P, uint64_t O, uint64_t *flips) {
+	int i = 0;
+#ifdef __AVX2__
+	const __m256i p = _mm256_set1_epi64x(P);
+	const __m256i o = _mm256_set1_epi64x(O);
+	const __m256i mask = _mm256_set1_epi64x(O & NOT_EDGE_COLS);
+	__m256i x, f;
+
+	for (; i + 4 <= n; i += 4) {
+		x = _mm256_set_epi64x(BIT(sq[i + 3]), BIT(sq[i + 2]), BIT(sq[i + 1]), BIT(sq[i]));
+		f = _mm256_or_si256(
+			_mm256_or_si256(flips_dir4(x, p, mask, 1), flips_dir4(x, p, o, 8)),
+			_mm256_or_si256(flips_dir4(x, p, mask, 7), flips_dir4(x, p, mask, 9)));
+		_mm256_storeu_si256((__m256i *)(flips + i), f);
+	}
+#endif
+	for (; i < n; i++) {
+		flips[i] = get_flips(sq[i], P, O);
+	}
+}
+
+/* Places a disc on sq, flips the given discs and hands the move over */
+static inline void position_play(struct Position *pos, int sq, uint64_t flips) {
+	uint64_t player = pos->player | flips | BIT(sq);
+
+	pos->player = pos->opponent & ~flips;
+	pos->opponent = player;
+	pos->colour = 3 - pos->colour;
+}
+
+/* Takes back position_play(pos, sq, flips) */
+static inline void position_undo(struct Position *pos, int sq, uint64_t flips) {
+	uint64_t player = pos->opponent & ~(flips | BIT(sq));
+
+	pos->opponent = pos->player | flips;
+	pos->player = player;
+	pos->colour = 3 - pos->colour;
+}
+
+static inline void position_pass(struct Position *pos) {
+	uint64_t player = pos->player;
+
+	pos->player = pos->opponent;
+	pos->opponent = player;
+	pos->colour = 3 - pos->colour;
+}
+
+/* Board symmetries: swaps row r with row 7 - r */
+static inline uint64_t flip_vertical(uint64_t b) {
+	return __builtin_bswap64(b);
+}
+
+/* Swaps column c with column 7 - c */
+static inline uint64_t mirror_horizontal(uint64_t b) {
+	b = ((b >> 1) & 0x5555555555555555ULL) | ((b & 0x5555555555555555ULL) << 1);
+	b = ((b >> 2) & 0x3333333333333333ULL) | ((b & 0x3333333333333333ULL) << 2);
+	b = ((b >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((b & 0x0F0F0F0F0F0F0F0FULL) << 4);
+	return b;
+}
+
+/*
+	Zobrist hashing. Every (colour, square) pair gets a random key and a
+	position hashes to the XOR of the keys of its discs, plus one more key
+	when white is to move. The keys come from a fixed seed so every rank
+	and every tool agrees on them.
+ */
+static uint64_t zobrist_keys[3][64];
+static uint64_t zobrist_flip[64];		/* black key ^ white key */
+static uint64_t zobrist_white;
+
+/* splitmix64 */
+static inline uint64_t zobrist_next(uint64_t *seed) {
+	uint64_t z = (*seed += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static inline void zobrist_init(void) {
+	uint64_t seed = 2021;
+
+	for (int sq = 0; sq < 64; sq++) {
+		zobrist_keys[0][sq] = 0;
+		zobrist_keys[1][sq] = zobrist_next(&seed);
+		zobrist_keys[2][sq] = zobrist_next(&seed);
+		zobrist_flip[sq] = zobrist_keys[1][sq] ^ zobrist_keys[2][sq];
+	}
+	zobrist_white = zobrist_next(&seed);
+}
+
+static inline uint64_t zobrist_hash(const struct Position *pos) {
+	uint64_t hash = pos->colour == 2 ? zobrist_white : 0;
+	uint64_t b;
+
+	for (b = pos->player; b; b &= b - 1)
+		hash ^= zobrist_keys[pos->colour][first_square(b)];
+	for (b = pos->opponent; b; b &= b - 1)
+		hash ^= zobrist_keys[3 - pos->colour][first_square(b)];
+	return hash;
+}
+
+/* Hash after colour plays sq flipping flips, given the hash before */
+static inline uint64_t zobrist_play(uint64_t hash, int colour, int sq, uint64_t flips) {
+	hash ^= zobrist_keys[colour][sq] ^ zobrist_white;
+	for (; flips; flips &= flips - 1)
+		hash ^= zobrist_flip[first_square(flips)];
+	return hash;
+}
+
+#endif
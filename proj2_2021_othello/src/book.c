@@ -0,0 +1,282 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Opening book builder.
+ *
+ *	Walks the game tree from the starting position and searches every
+ *	position it meets with an alpha-beta over the pattern evaluation.
+ *	Every reply is followed for the first few plies; after that only the
+ *	two best moves are, which keeps the book to the lines that actually
+ *	get played. Symmetric positions are stored once (see book.h). The
+ *	evaluation is the player's: player/weights.bin or OTHELLO_WEIGHTS if
+ *	there is one, else the hand weights.
+ *
+ *	The player ignores entries searched shallower than its BOOK_MIN_DEPTH
+ *	(12), since its own search gets that far in the opening anyway, so a
+ *	book built with a smaller depth is never used.
+ *
+ *	Usage: book [file] [all-move plies] [plies] [depth]
+ *	(defaults player/book.bin 2 8 12)
+ *H***********************************************************************/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+
+#include "bitboard.h"
+#include "pattern.h"
+#include "weights.h"
+#include "book.h"
+
+#define DEFAULT_FULL_PLIES 2
+#define DEFAULT_PLIES 8
+#define DEFAULT_DEPTH 12
+#define BEST_MOVES 2
+/* search() sorts the moves this many plies or more from the leaves */
+#define ORDER_DEPTH 3
+
+/* Beyond any evaluation, so a won game always beats a good position */
+#define WIN_SCORE 1000
+
+#define SET_BITS 22
+#define SET_SIZE (1 << SET_BITS)
+
+/* Transposition table of search(), 24 MB */
+#define TABLE_BITS 20
+#define TABLE_EXACT 0
+#define TABLE_LOWER 1		/* score is at least this */
+#define TABLE_UPPER 2		/* score is at most this */
+
+struct TableEntry {
+	uint64_t player;		/* the whole position, 0/0 = free */
+	uint64_t opponent;
+	int16_t score;
+	uint8_t depth;
+	uint8_t bound;
+	int8_t move;			/* best or cut off move, -1 if none */
+};
+
+struct BookEntry *entries;
+uint64_t count;
+uint64_t *seen;		/* open addressing set of keys, 0 = free */
+struct TableEntry *table;
+int full_plies = DEFAULT_FULL_PLIES;
+int plies = DEFAULT_PLIES;
+int depth = DEFAULT_DEPTH;
+unsigned long long nodes;
+
+void build(uint64_t P, uint64_t O, int ply);
+int search(uint64_t P, uint64_t O, int depth, int alpha, int beta);
+struct TableEntry *table_entry(uint64_t P, uint64_t O);
+int mark_seen(uint64_t key);
+int compare_entries(const void *a, const void *b);
+double now();
+
+int main(int argc, char *argv[]) {
+	const char *path = BOOK_DEFAULT_PATH;
+	struct BookHeader header;
+	FILE *out;
+	char *weights = getenv("OTHELLO_WEIGHTS");
+	double start;
+
+	if (argc > 1) path = argv[1];
+	if (argc > 2) full_plies = atoi(argv[2]);
+	if (argc > 3) plies = atoi(argv[3]);
+	if (argc > 4) depth = atoi(argv[4]);
+	if (full_plies < 0 || plies < full_plies || plies > 30 || depth < 1) {
+		fprintf(stderr, "usage: book [file] [all-move plies] [plies] [depth]\n");
+		return 2;
+	}
+
+	pattern_init();
+	// The player's weights if there are any, see weights.h
+	weights_load(weights ? weights : WEIGHTS_DEFAULT_PATH);
+	entries = malloc(SET_SIZE / 2 * sizeof(struct BookEntry));
+	seen = calloc(SET_SIZE, sizeof(uint64_t));
+	table = calloc((size_t)1 << TABLE_BITS, sizeof(struct TableEntry));
+	if (!entries || !seen || !table) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	start = now();
+	build(BIT(SQUARE(3, 4)) | BIT(SQUARE(4, 3)), BIT(SQUARE(3, 3)) | BIT(SQUARE(4, 4)), 0);
+	qsort(entries, count, sizeof(struct BookEntry), compare_entries);
+
+	out = fopen(path, "wb");
+	if (!out) {
+		perror(path);
+		return 1;
+	}
+	header.magic = BOOK_MAGIC;
+	header.count = count;
+	if (fwrite(&header, sizeof(header), 1, out) != 1
+			|| fwrite(entries, sizeof(struct BookEntry), count, out) != count
+			|| fclose(out) != 0) {
+		perror(path);
+		return 1;
+	}
+	printf("%llu positions, %llu nodes, %.1f s -> %s\n", (unsigned long long)count,
+			nodes, now() - start, path);
+	return 0;
+}
+
+/*
+	Adds P to move against O and follows its moves. Positions without a
+	move (passes and finished games) are left out of the book.
+ */
+void build(uint64_t P, uint64_t O, int ply) {
+	uint64_t moves = get_moves(P, O), flips, key;
+	int scores[64], sqs[64], n = 0, best = 0, second = -1, s;
+
+	if (ply >= plies || !moves) {
+		return;
+	}
+	s = book_key(P, O, &key);
+	if (!mark_seen(key) || count == SET_SIZE / 2) {
+		return;
+	}
+
+	// Only the best two moves matter, so a move only has to be searched
+	// exactly if it beats the second best so far
+	for (; moves; moves &= moves - 1, n++) {
+		sqs[n] = first_square(moves);
+		flips = get_flips(sqs[n], P, O);
+		scores[n] = -search(O & ~flips, P | flips | BIT(sqs[n]), depth - 1,
+				-WIN_SCORE - 64, second == -1 ? WIN_SCORE + 64 : -scores[second]);
+		if (n == 0 || scores[n] > scores[best]) {
+			second = n == 0 ? -1 : best;
+			best = n;
+		} else if (second == -1 || scores[n] > scores[second]) {
+			second = n;
+		}
+	}
+
+	entries[count].key = key;
+	entries[count].score = scores[best];
+	entries[count].move = first_square(symmetry(BIT(sqs[best]), s));
+	entries[count].depth = depth;
+	entries[count].reserved = 0;
+	count++;
+
+	for (int i = 0; i < n; i++) {
+		if (ply < full_plies || i == best || (BEST_MOVES > 1 && i == second)) {
+			flips = get_flips(sqs[i], P, O);
+			build(O & ~flips, P | flips | BIT(sqs[i]), ply + 1);
+		}
+	}
+}
+
+/*
+	Negamax alpha-beta for P to move, scores from P's side. The move the
+	table remembers goes first and, away from the leaves, the others best
+	evaluated first, which is what makes a book as deep as the player's
+	own search affordable.
+ */
+int search(uint64_t P, uint64_t O, int depth, int alpha, int beta) {
+	uint64_t moves, flips, players[32], opponents[32], t;
+	int score, diff, sqs[32], order[32], n = 0, k, best = -1, old_alpha = alpha;
+	struct TableEntry *entry;
+
+	nodes++;
+	if (depth == 0) {
+		return pattern_evaluate(P, O);
+	}
+	moves = get_moves(P, O);
+	if (!moves) {
+		if (get_moves(O, P)) {
+			return -search(O, P, depth, -beta, -alpha);
+		}
+		diff = popcount(P) - popcount(O);
+		return diff > 0 ? WIN_SCORE + diff : diff < 0 ? -WIN_SCORE + diff : 0;
+	}
+
+	entry = table_entry(P, O);
+	if (entry->player == P && entry->opponent == O) {
+		if (entry->depth >= depth) {
+			if (entry->bound != TABLE_UPPER && entry->score >= beta) return beta;
+			if (entry->bound != TABLE_LOWER && entry->score <= alpha) return alpha;
+			if (entry->bound == TABLE_EXACT) return entry->score;
+		}
+		best = entry->move;
+	}
+
+	for (; moves; moves &= moves - 1, n++) {
+		sqs[n] = first_square(moves);
+		flips = get_flips(sqs[n], P, O);
+		players[n] = O & ~flips;
+		opponents[n] = P | flips | BIT(sqs[n]);
+		order[n] = sqs[n] == best ? -2 * WIN_SCORE
+				: depth >= ORDER_DEPTH ? pattern_evaluate(players[n], opponents[n]) : 0;
+		// Insertion sort, lowest score for the opponent first
+		for (k = n; k > 0 && order[k] < order[k - 1]; k--) {
+			diff = order[k]; order[k] = order[k - 1]; order[k - 1] = diff;
+			diff = sqs[k]; sqs[k] = sqs[k - 1]; sqs[k - 1] = diff;
+			t = players[k]; players[k] = players[k - 1]; players[k - 1] = t;
+			t = opponents[k]; opponents[k] = opponents[k - 1]; opponents[k - 1] = t;
+		}
+	}
+	best = -1;
+	for (k = 0; k < n; k++) {
+		if (k == 0) {
+			score = -search(players[k], opponents[k], depth - 1, -beta, -alpha);
+		} else {
+			score = -search(players[k], opponents[k], depth - 1, -alpha - 1, -alpha);
+			if (score > alpha && score < beta) {
+				score = -search(players[k], opponents[k], depth - 1, -beta, -alpha);
+			}
+		}
+		if (score > alpha) {
+			alpha = score;
+			best = sqs[k];
+			if (alpha >= beta) {
+				break;
+			}
+		}
+	}
+
+	entry->player = P;
+	entry->opponent = O;
+	entry->score = alpha;
+	entry->depth = depth;
+	entry->bound = alpha <= old_alpha ? TABLE_UPPER : alpha >= beta ? TABLE_LOWER : TABLE_EXACT;
+	entry->move = best;
+	return alpha;
+}
+
+/* The table slot of P to move against O, always replaced */
+struct TableEntry *table_entry(uint64_t P, uint64_t O) {
+	uint64_t h = P ^ (O * 0x9E3779B97F4A7C15ULL);
+
+	return &table[zobrist_next(&h) >> (64 - TABLE_BITS)];
+}
+
+/* Returns 1 if key was not in the set yet */
+int mark_seen(uint64_t key) {
+	uint64_t i = key >> (64 - SET_BITS);
+
+	key |= 1;	// keeps 0 free as the empty marker
+	for (; seen[i]; i = (i + 1) & (SET_SIZE - 1)) {
+		if (seen[i] == key) {
+			return 0;
+		}
+	}
+	seen[i] = key;
+	return 1;
+}
+
+int compare_entries(const void *a, const void *b) {
+	uint64_t x = ((const struct BookEntry *)a)->key;
+	uint64_t y = ((const struct BookEntry *)b)->key;
+
+	return x < y ? -1 : x > y;
+}
+
+double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,115 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Opening book format, shared by the book builder and the engines.
+ *
+ *	The book is a flat binary file: a header followed by entries sorted
+ *	by key. A key is a hash of the position after it has been rotated or
+ *	reflected into a canonical orientation, so the eight symmetric copies
+ *	of a position share one entry. The stored move is in that canonical
+ *	orientation and is turned back by book_probe().
+ *
+ *	The engines map the file read-only and binary search it in place, so
+ *	opening it costs nothing and nothing has to be parsed.
+ *H***********************************************************************/
+
+#ifndef BOOK_H
+#define BOOK_H
+
+#include<stdint.h>
+
+#include "bitboard.h"
+
+#define BOOK_MAGIC 0x314B4F4F424C544FULL	/* "OTLBOOK1" */
+#define BOOK_DEFAULT_PATH "player/book.bin"
+
+struct BookHeader {
+	uint64_t magic;
+	uint64_t count;		/* number of entries that follow */
+};
+
+struct BookEntry {
+	uint64_t key;
+	int16_t score;		/* for the side to move */
+	uint8_t move;		/* canonical square */
+	uint8_t depth;		/* search depth the entry came from */
+	uint32_t reserved;
+};
+
+/* Swaps row r and column r, i.e. square (r, c) with (c, r) */
+static inline uint64_t transpose(uint64_t b) {
+	uint64_t t;
+
+	t = 0x0F0F0F0F00000000ULL & (b ^ (b << 28));
+	b ^= t ^ (t >> 28);
+	t = 0x3333000033330000ULL & (b ^ (b << 14));
+	b ^= t ^ (t >> 14);
+	t = 0x5500550055005500ULL & (b ^ (b << 7));
+	b ^= t ^ (t >> 7);
+	return b;
+}
+
+/* Symmetry s of the board, 0..7: bit 0 mirrors, bit 1 flips, bit 2 transposes */
+static inline uint64_t symmetry(uint64_t b, int s) {
+	if (s & 1) b = mirror_horizontal(b);
+	if (s & 2) b = flip_vertical(b);
+	if (s & 4) b = transpose(b);
+	return b;
+}
+
+/* Undoes symmetry(b, s) */
+static inline uint64_t symmetry_inverse(uint64_t b, int s) {
+	if (s & 4) b = transpose(b);
+	if (s & 2) b = flip_vertical(b);
+	if (s & 1) b = mirror_horizontal(b);
+	return b;
+}
+
+/*
+	Picks the symmetry giving the smallest (P, O) pair, writes the key of
+	that orientation and returns the symmetry used.
+ */
+static inline int book_key(uint64_t P, uint64_t O, uint64_t *key) {
+	uint64_t best_p = P, best_o = O, p, o, h;
+	int best = 0;
+
+	for (int s = 1; s < 8; s++) {
+		p = symmetry(P, s);
+		o = symmetry(O, s);
+		if (p < best_p || (p == best_p && o < best_o)) {
+			best_p = p; best_o = o; best = s;
+		}
+	}
+	h = best_p ^ (best_o * 0x9E3779B97F4A7C15ULL);
+	*key = zobrist_next(&h);
+	return best;
+}
+
+/*
+	Looks up P to move against O in count sorted entries. Returns the move
+	as a square of the real board, or -1 if the position is not in the book.
+	The entry's score and search depth go to score and depth.
+ */
+static inline int book_probe(const struct BookEntry *entries, uint64_t count,
+		uint64_t P, uint64_t O, int *score, int *depth) {
+	uint64_t key, lo = 0, hi = count, mid;
+	int s = book_key(P, O, &key);
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (entries[mid].key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == count || entries[lo].key != key) {
+		return -1;
+	}
+	*score = entries[lo].score;
+	*depth = entries[lo].depth;
+	return first_square(symmetry_inverse(BIT(entries[lo].move), s));
+}
+
+#endif
@@ -0,0 +1,200 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Buffered logging for the Othello engines.
+ *
+ *	Messages are formatted into an in-memory ring buffer and a background
+ *	thread writes the buffer out to this rank's own file every
+ *	LOG_FLUSH_MS milliseconds, so logging never makes a system call or
+ *	waits on a shared file from inside a search. If the ring fills up
+ *	faster than it drains, new messages are dropped (and counted) rather
+ *	than making the caller wait.
+ *
+ *	LOG_LEVEL picks what gets compiled in, e.g. -DLOG_LEVEL=LOG_DEBUG.
+ *	Calls above the level expand to nothing, arguments included.
+ *H***********************************************************************/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include<stdio.h>
+#include<stdarg.h>
+#include<stdint.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<time.h>
+
+#define LOG_NONE 0
+#define LOG_ERROR 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+#define LOG_RING_SIZE (1 << 20)		/* bytes, a power of two */
+#define LOG_LINE_SIZE 512			/* longest single message */
+#define LOG_FLUSH_MS 100
+
+#if LOG_LEVEL >= LOG_ERROR
+#define log_error(...) log_write(__VA_ARGS__)
+#else
+#define log_error(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_INFO
+#define log_info(...) log_write(__VA_ARGS__)
+#else
+#define log_info(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_DEBUG
+#define log_debug(...) log_write(__VA_ARGS__)
+#else
+#define log_debug(...) ((void)0)
+#endif
+
+struct Log {
+	char ring[LOG_RING_SIZE];
+	uint64_t head;			/* bytes written into the ring so far */
+	uint64_t tail;			/* bytes written out to the file so far */
+	uint64_t dropped;
+	int fd;
+	int quit;
+	pthread_t flusher;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+static struct Log logger = {.fd = -1};
+
+/* Copies out what is in the ring; only the flusher thread calls this */
+static inline void log_drain(void) {
+	uint64_t head, tail, start, len;
+	ssize_t n;
+
+	pthread_mutex_lock(&logger.lock);
+	head = logger.head;
+	tail = logger.tail;
+	pthread_mutex_unlock(&logger.lock);
+
+	while (tail < head) {
+		start = tail & (LOG_RING_SIZE - 1);
+		len = head - tail;
+		if (start + len > LOG_RING_SIZE) {
+			len = LOG_RING_SIZE - start;
+		}
+		n = write(logger.fd, logger.ring + start, len);
+		if (n <= 0) {
+			break;
+		}
+		tail += n;
+	}
+
+	pthread_mutex_lock(&logger.lock);
+	logger.tail = head;		// anything that failed to write is given up on
+	pthread_mutex_unlock(&logger.lock);
+}
+
+static inline void *log_flusher(void *arg) {
+	struct timespec until;
+	int quit = 0;
+
+	(void)arg;
+	while (!quit) {
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += LOG_FLUSH_MS * 1000000L;
+		until.tv_sec += until.tv_nsec / 1000000000L;
+		until.tv_nsec %= 1000000000L;
+
+		pthread_mutex_lock(&logger.lock);
+		if (!logger.quit) {
+			pthread_cond_timedwait(&logger.wake, &logger.lock, &until);
+		}
+		quit = logger.quit;
+		pthread_mutex_unlock(&logger.lock);
+		log_drain();
+	}
+	return NULL;
+}
+
+/*
+	Opens path for this process and starts the flusher. Without a file the
+	messages are simply thrown away.
+ */
+static inline void log_open(const char *path) {
+	pthread_mutex_init(&logger.lock, NULL);
+	pthread_cond_init(&logger.wake, NULL);
+	logger.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (logger.fd < 0) {
+		return;
+	}
+	if (pthread_create(&logger.flusher, NULL, log_flusher, NULL) != 0) {
+		close(logger.fd);
+		logger.fd = -1;
+	}
+}
+
+/* Writes out everything still buffered and stops the flusher */
+static inline void log_close(void) {
+	char line[64];
+	int len;
+
+	if (logger.fd < 0) {
+		return;
+	}
+	pthread_mutex_lock(&logger.lock);
+	logger.quit = 1;
+	pthread_cond_signal(&logger.wake);
+	pthread_mutex_unlock(&logger.lock);
+	pthread_join(logger.flusher, NULL);
+
+	if (logger.dropped) {
+		len = snprintf(line, sizeof(line), "(%llu log messages dropped)\n",
+				(unsigned long long)logger.dropped);
+		if (write(logger.fd, line, len) != len) {
+			// Nowhere left to report it
+		}
+	}
+	close(logger.fd);
+	logger.fd = -1;
+}
+
+/* printf into the ring; safe from any thread */
+static inline void log_write(const char *format, ...) {
+	char line[LOG_LINE_SIZE];
+	uint64_t start, first;
+	va_list args;
+	int len;
+
+	if (logger.fd < 0) {
+		return;
+	}
+	va_start(args, format);
+	len = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if (len <= 0) {
+		return;
+	}
+	if (len >= LOG_LINE_SIZE) {
+		len = LOG_LINE_SIZE - 1;
+	}
+
+	pthread_mutex_lock(&logger.lock);
+	if (logger.head - logger.tail + len > LOG_RING_SIZE) {
+		logger.dropped++;
+	} else {
+		start = logger.head & (LOG_RING_SIZE - 1);
+		first = LOG_RING_SIZE - start < (uint64_t)len ? LOG_RING_SIZE - start : (uint64_t)len;
+		memcpy(logger.ring + start, line, first);
+		memcpy(logger.ring, line + first, len - first);
+		logger.head += len;
+	}
+	pthread_mutex_unlock(&logger.lock);
+}
+
+#endif
@@ -0,0 +1,219 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Monte Carlo tree search for the Othello engines.
+ *
+ *	Every iteration walks down the tree picking children by UCT, adds the
+ *	children of the node it stops at, plays one random game from there
+ *	on the bitboards and counts the result back up the path. Nodes come
+ *	out of one preallocated pool, a whole family at a time, so the search
+ *	never calls malloc and a family sits together in memory.
+ *
+ *	Any number of threads can run iterations on the same tree. A thread
+ *	counts its visit on the way down (a virtual loss until the result is
+ *	added on the way back), which steers the other threads to different
+ *	lines, and a node is expanded by whichever thread claims it first.
+ *H***********************************************************************/
+
+#ifndef MCTS_H
+#define MCTS_H
+
+#include<stdint.h>
+#include<math.h>
+
+#include "bitboard.h"
+
+/* UCT exploration constant for results scored 0..1 */
+#define MCTS_EXPLORATION 1.0
+/* A leaf gets its children on this visit; until then it only gets playouts */
+#define MCTS_EXPAND_VISITS 2
+#define MCTS_MAX_PATH 128		/* moves and passes from the root to the end */
+
+#define MCTS_LEAF 0				/* first: no children yet */
+#define MCTS_EXPANDING -1		/* first: a thread is adding the children */
+#define MCTS_END -2				/* first: the game is over here */
+
+struct MctsNode {
+	uint64_t player;		/* discs of the side to move here */
+	uint64_t opponent;
+	int first;				/* pool index of the first child, or the above */
+	int count;				/* children */
+	int move;				/* square played to get here, -1 for a pass */
+	int visits;				/* iterations through here, running ones included */
+	int score;				/* 2 per win and 1 per draw for the side that moved here */
+};
+
+struct MctsTree {
+	struct MctsNode *nodes;
+	int capacity;
+	int used;
+};
+
+/* xorshift64*, one state per thread */
+static inline uint64_t mcts_random(uint64_t *state) {
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* A random set bit of b, which must not be 0 */
+static inline int mcts_pick(uint64_t b, uint64_t *state) {
+	int k = (int)((mcts_random(state) >> 32) * (uint64_t)popcount(b) >> 32);
+
+	for (; k > 0; k--) {
+		b &= b - 1;
+	}
+	return first_square(b);
+}
+
+/* 2, 1 or 0 as the finished game is a win, draw or loss for P */
+static inline int mcts_result(uint64_t P, uint64_t O) {
+	int diff = popcount(P) - popcount(O);
+
+	return diff > 0 ? 2 : diff == 0 ? 1 : 0;
+}
+
+/* Plays random moves to the end of the game, result for P as above */
+static inline int mcts_playout(uint64_t P, uint64_t O, uint64_t *state) {
+	uint64_t moves, flips, t;
+	int sq, swapped = 0, passes = 0;
+
+	while (passes < 2) {
+		moves = get_moves(P, O);
+		if (moves) {
+			sq = mcts_pick(moves, state);
+			flips = get_flips(sq, P, O);
+			P |= flips | BIT(sq);
+			O &= ~flips;
+			passes = 0;
+		} else {
+			passes++;
+		}
+		t = P; P = O; O = t;
+		swapped ^= 1;
+	}
+	return swapped ? mcts_result(O, P) : mcts_result(P, O);
+}
+
+/* Empties the tree down to a root for P to move against O */
+static inline void mcts_reset(struct MctsTree *tree, uint64_t P, uint64_t O) {
+	struct MctsNode *root = &tree->nodes[0];
+
+	root->player = P;
+	root->opponent = O;
+	root->first = MCTS_LEAF;
+	root->count = 0;
+	root->move = -1;
+	root->visits = 0;
+	root->score = 0;
+	tree->used = 1;
+}
+
+/*
+	Adds the children of node i if this thread gets to. A side without a
+	move gets a single pass child; a finished game gets none. Returns 0 if
+	another thread is already at it or the pool is full.
+ */
+static inline int mcts_expand(struct MctsTree *tree, int i) {
+	struct MctsNode *node = &tree->nodes[i], *child;
+	uint64_t moves = get_moves(node->player, node->opponent), flips;
+	int expected = MCTS_LEAF, count, start, sq;
+
+	if (!__atomic_compare_exchange_n(&node->first, &expected, MCTS_EXPANDING,
+			0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	count = moves ? popcount(moves) : get_moves(node->opponent, node->player) ? 1 : 0;
+	start = __atomic_fetch_add(&tree->used, count, __ATOMIC_RELAXED);
+	if (start + count > tree->capacity) {
+		__atomic_store_n(&node->first, MCTS_LEAF, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	child = &tree->nodes[start];
+	if (!moves && count) {
+		child->player = node->opponent;
+		child->opponent = node->player;
+		child->move = -1;
+	}
+	for (; moves; moves &= moves - 1, child++) {
+		sq = first_square(moves);
+		flips = get_flips(sq, node->player, node->opponent);
+		child->player = node->opponent & ~flips;
+		child->opponent = node->player | flips | BIT(sq);
+		child->move = sq;
+	}
+	for (int c = start; c < start + count; c++) {
+		tree->nodes[c].first = MCTS_LEAF;
+		tree->nodes[c].count = 0;
+		tree->nodes[c].visits = 0;
+		tree->nodes[c].score = 0;
+	}
+	node->count = count;
+	__atomic_store_n(&node->first, count ? start : MCTS_END, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/* The child of node i with the best UCT value; unvisited children go first */
+static inline int mcts_select(const struct MctsTree *tree, int i) {
+	const struct MctsNode *node = &tree->nodes[i];
+	double log_visits = log((double)node->visits + 1), value, best_value = -1;
+	int best = node->first, visits;
+
+	for (int c = node->first; c < node->first + node->count; c++) {
+		visits = __atomic_load_n(&tree->nodes[c].visits, __ATOMIC_RELAXED);
+		if (visits == 0) {
+			return c;
+		}
+		value = __atomic_load_n(&tree->nodes[c].score, __ATOMIC_RELAXED) / (2.0 * visits)
+			+ MCTS_EXPLORATION * sqrt(log_visits / visits);
+		if (value > best_value) {
+			best_value = value;
+			best = c;
+		}
+	}
+	return best;
+}
+
+/* One iteration: select, expand, play out and back up */
+static inline void mcts_iterate(struct MctsTree *tree, uint64_t *state) {
+	int path[MCTS_MAX_PATH];
+	int depth = 0, i = 0, first, result;
+	struct MctsNode *node;
+
+	path[depth++] = 0;
+	__atomic_fetch_add(&tree->nodes[0].visits, 1, __ATOMIC_RELAXED);
+	while (1) {
+		node = &tree->nodes[i];
+		first = __atomic_load_n(&node->first, __ATOMIC_ACQUIRE);
+		if (first == MCTS_LEAF && node->visits >= MCTS_EXPAND_VISITS && mcts_expand(tree, i)) {
+			first = node->first;
+		}
+		if (first <= 0 || depth == MCTS_MAX_PATH) {
+			break;
+		}
+		i = mcts_select(tree, i);
+		path[depth++] = i;
+		__atomic_fetch_add(&tree->nodes[i].visits, 1, __ATOMIC_RELAXED);
+	}
+
+	node = &tree->nodes[i];
+	if (first == MCTS_END) {
+		result = mcts_result(node->player, node->opponent);
+	} else {
+		result = mcts_playout(node->player, node->opponent, state);
+	}
+
+	// result is for the side to move at path[d]; score is for the one before
+	while (depth-- > 0) {
+		__atomic_fetch_add(&tree->nodes[path[depth]].score, 2 - result, __ATOMIC_RELAXED);
+		result = 2 - result;
+	}
+}
+
+#endif
@@ -0,0 +1,335 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Pattern-table evaluation for the Othello engines.
+ *
+ *	The board is cut into overlapping lines and regions (the four edges,
+ *	the four 3x3 corner regions and the two long diagonals). Each one is
+ *	read as a base-3 number, one digit per square (0 empty, 1 mine,
+ *	2 theirs), and that number indexes a table of precomputed scores.
+ *	There is one set of tables per game stage, so a C-square can cost a
+ *	lot in the opening and nothing once the corners are settled.
+ *
+ *	Every pattern is read so that digit 0 is a corner, which lets one
+ *	table serve all four edges and one table all four corners.
+ *
+ *	pattern_evaluate() works from the two bitboards. A search can instead
+ *	keep a PatternState up to date as discs are placed and flipped, which
+ *	turns the evaluation into ten table reads.
+ *H***********************************************************************/
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include<stdint.h>
+
+#include "bitboard.h"
+
+#define PATTERN_STAGES 4
+#define EDGE_PATTERNS 6561		/* 3^8 */
+#define CORNER_PATTERNS 19683	/* 3^9 */
+
+/*
+	Hand weights the tables are built from. With these the largest score a
+	position can get is well inside +-1000, the engines' search bounds.
+ */
+#define CORNER_WEIGHT 30
+#define EDGE_WEIGHT 5
+#define STABLE_WEIGHT 5
+#define DIAGONAL_WEIGHT 3
+static const int16_t DISC_WEIGHT[PATTERN_STAGES] = {3, 5, 7, 8};
+static const int16_t C_SQUARE_WEIGHT[PATTERN_STAGES] = {10, 8, 5, 0};
+static const int16_t X_SQUARE_WEIGHT[PATTERN_STAGES] = {25, 20, 12, 0};
+static const int16_t X_OPEN_WEIGHT[PATTERN_STAGES] = {15, 15, 10, 0};
+
+/*
+	Tables [0] score digit 1 against digit 2. Tables [1] are the same with
+	the digits swapped, so a PatternState (digit 1 black, 2 white) can be
+	scored for white without converting its indices.
+ */
+static int16_t edge_table[2][PATTERN_STAGES][EDGE_PATTERNS];
+static int16_t corner_table[2][PATTERN_STAGES][CORNER_PATTERNS];
+static int16_t diagonal_table[2][PATTERN_STAGES][EDGE_PATTERNS];
+static int16_t disc_weight[PATTERN_STAGES];
+
+/* base3[b] has digit i set to 1 for every bit i of b */
+static uint16_t base3[512];
+
+/*
+	Patterns in the order of pattern_evaluate(): edges 0..3, corner
+	regions 4..7, diagonals 8 and 9.
+
+	A PatternState keeps their indices (digit 1 black, 2 white) for the
+	search. Index p is the 16-bit lane p % 4 of word p / 4, and
+	square_delta[sq] holds the value of sq's digit in every pattern it is
+	part of in the same lanes. Placing or flipping a disc is then three
+	additions whatever the square. No lane ever leaves 0..19682, so no
+	carry crosses into the next one.
+ */
+#define PATTERN_COUNT 10
+#define PATTERN_WORDS 3
+#define FIRST_CORNER 4
+#define FIRST_DIAGONAL 8
+
+static uint64_t square_delta[64][PATTERN_WORDS];
+
+struct PatternState {
+	uint64_t index[PATTERN_WORDS];
+	int discs;				/* on the board */
+	int balance;			/* black discs minus white discs */
+};
+
+/* 0..3 for 4..19, 20..35, 36..51 and 52..64 discs */
+static inline int pattern_stage(uint64_t mine, uint64_t theirs) {
+	return (popcount(mine | theirs) - 4) >> 4;
+}
+
+static inline int pattern_index(unsigned mine, unsigned theirs) {
+	return base3[mine] + 2 * base3[theirs];
+}
+
+/* Column 0 as 8 bits, row r in bit r */
+static inline unsigned column_bits(uint64_t b) {
+	return ((b & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56;
+}
+
+/* Square (r, r) in bit r */
+static inline unsigned diagonal_bits(uint64_t b) {
+	return ((b & 0x8040201008040201ULL) * 0x0101010101010101ULL) >> 56;
+}
+
+/* Square (r, 7 - r) in bit 7 - r */
+static inline unsigned anti_diagonal_bits(uint64_t b) {
+	return ((b & 0x0102040810204080ULL) * 0x0101010101010101ULL) >> 56;
+}
+
+/* The 3x3 region at square 0, row by row */
+static inline unsigned corner_bits(uint64_t b) {
+	return (b & 0x7) | ((b >> 5) & 0x38) | ((b >> 10) & 0x1C0);
+}
+
+/* Score of the position for the owner of mine */
+static inline int pattern_evaluate(uint64_t mine, uint64_t theirs) {
+	const int stage = pattern_stage(mine, theirs);
+	const int16_t *edge = edge_table[0][stage];
+	const int16_t *corner = corner_table[0][stage];
+	const int16_t *diagonal = diagonal_table[0][stage];
+	uint64_t mine_h = mirror_horizontal(mine);
+	uint64_t theirs_h = mirror_horizontal(theirs);
+	int score;
+
+	score = disc_weight[stage] * (popcount(mine) - popcount(theirs));
+
+	score += edge[pattern_index(mine & 0xFF, theirs & 0xFF)];
+	score += edge[pattern_index(mine >> 56, theirs >> 56)];
+	score += edge[pattern_index(column_bits(mine), column_bits(theirs))];
+	score += edge[pattern_index(column_bits(mine >> 7), column_bits(theirs >> 7))];
+
+	score += corner[pattern_index(corner_bits(mine), corner_bits(theirs))];
+	score += corner[pattern_index(corner_bits(mine_h), corner_bits(theirs_h))];
+	score += corner[pattern_index(corner_bits(flip_vertical(mine)),
+			corner_bits(flip_vertical(theirs)))];
+	score += corner[pattern_index(corner_bits(flip_vertical(mine_h)),
+			corner_bits(flip_vertical(theirs_h)))];
+
+	score += diagonal[pattern_index(diagonal_bits(mine), diagonal_bits(theirs))];
+	score += diagonal[pattern_index(anti_diagonal_bits(mine), anti_diagonal_bits(theirs))];
+	return score;
+}
+
+/*
+	Both updates take the colour as a number rather than branching on it:
+	sign is +1 for black and -1 for white.
+ */
+#define PATTERN_SIGN(colour) (3 - 2 * (colour))
+
+/* colour 1 (black) or 2 (white) puts a disc on the empty square sq */
+static inline void pattern_place(struct PatternState *st, int colour, int sq) {
+	st->index[0] += colour * square_delta[sq][0];
+	st->index[1] += colour * square_delta[sq][1];
+	st->index[2] += colour * square_delta[sq][2];
+	st->discs++;
+	st->balance += PATTERN_SIGN(colour);
+}
+
+/* The disc on sq turns to colour: digit 2 -> 1 or 1 -> 2 */
+static inline void pattern_flip(struct PatternState *st, int colour, int sq) {
+	const int64_t sign = PATTERN_SIGN(colour);
+
+	st->index[0] -= sign * square_delta[sq][0];
+	st->index[1] -= sign * square_delta[sq][1];
+	st->index[2] -= sign * square_delta[sq][2];
+	st->balance += 2 * sign;
+}
+
+static inline void pattern_state_init(struct PatternState *st, uint64_t black, uint64_t white) {
+	for (int w = 0; w < PATTERN_WORDS; w++) {
+		st->index[w] = 0;
+	}
+	st->discs = 0;
+	st->balance = 0;
+	for (; black; black &= black - 1) pattern_place(st, 1, first_square(black));
+	for (; white; white &= white - 1) pattern_place(st, 2, first_square(white));
+}
+
+#define PATTERN_LANE(st, p) (((st)->index[(p) / 4] >> (16 * ((p) % 4))) & 0xFFFF)
+
+/* Same score as pattern_evaluate() for colour's discs against the rest */
+static inline int pattern_state_evaluate(const struct PatternState *st, int colour) {
+	const int stage = (st->discs - 4) >> 4;
+	const int16_t *edge = edge_table[colour - 1][stage];
+	const int16_t *corner = corner_table[colour - 1][stage];
+	const int16_t *diagonal = diagonal_table[colour - 1][stage];
+
+	return disc_weight[stage] * PATTERN_SIGN(colour) * st->balance
+		+ edge[PATTERN_LANE(st, 0)] + edge[PATTERN_LANE(st, 1)]
+		+ edge[PATTERN_LANE(st, 2)] + edge[PATTERN_LANE(st, 3)]
+		+ corner[PATTERN_LANE(st, 4)] + corner[PATTERN_LANE(st, 5)]
+		+ corner[PATTERN_LANE(st, 6)] + corner[PATTERN_LANE(st, 7)]
+		+ diagonal[PATTERN_LANE(st, 8)] + diagonal[PATTERN_LANE(st, 9)];
+}
+
+/* Records that digit of pattern p is the square at row, col */
+static inline void pattern_square(int p, int digit, int row, int col) {
+	uint64_t power = 1;
+
+	for (int i = 0; i < digit; i++) {
+		power *= 3;
+	}
+	square_delta[SQUARE(row, col)][p / 4] += power << (16 * (p % 4));
+}
+
+/* Splits a pattern index into +1 (mine), -1 (theirs) and 0 (empty) */
+static inline void pattern_digits(int index, int n, int *v) {
+	for (int i = 0; i < n; i++, index /= 3) {
+		v[i] = index % 3 == 2 ? -1 : index % 3;
+	}
+}
+
+/*
+	Edge: the six squares between the corners (the corners themselves are
+	scored by the corner regions), a bonus for discs that can never be
+	flipped along the edge and a penalty for a C-square next to an empty
+	corner.
+ */
+static inline int edge_score(int stage, int index) {
+	int v[8], stable[8] = {0};
+	int score = 0, full = 1;
+
+	pattern_digits(index, 8, v);
+	for (int i = 0; i < 8; i++) {
+		full &= v[i] != 0;
+	}
+	// Runs anchored on a corner are stable, and so is a full edge
+	for (int i = 0; v[0] && i < 8 && v[i] == v[0]; i++) stable[i] = 1;
+	for (int i = 7; v[7] && i >= 0 && v[i] == v[7]; i--) stable[i] = 1;
+	for (int i = 1; i < 7; i++) {
+		score += EDGE_WEIGHT * v[i];
+		if (stable[i] || full) {
+			score += STABLE_WEIGHT * v[i];
+		}
+	}
+	if (!v[0]) score -= C_SQUARE_WEIGHT[stage] * v[1];
+	if (!v[7]) score -= C_SQUARE_WEIGHT[stage] * v[6];
+	return score;
+}
+
+/*
+	Corner region: the corner itself, and the X-square next to it while the
+	corner is still empty. An X-square backed by an opposing disc further
+	along the diagonal hands the corner over, so it costs more.
+ */
+static inline int corner_score(int stage, int index) {
+	int v[9];
+	int score;
+
+	pattern_digits(index, 9, v);
+	score = CORNER_WEIGHT * v[0];
+	if (!v[0] && v[4]) {
+		score -= X_SQUARE_WEIGHT[stage] * v[4];
+		if (v[8] == -v[4]) {
+			score -= X_OPEN_WEIGHT[stage] * v[4];
+		}
+	}
+	return score;
+}
+
+/* Long diagonal: squares between the corners */
+static inline int diagonal_score(int index) {
+	int v[8];
+	int score = 0;
+
+	pattern_digits(index, 8, v);
+	for (int i = 1; i < 7; i++) {
+		score += DIAGONAL_WEIGHT * v[i];
+	}
+	return score;
+}
+
+/* Index with the digits 1 and 2 swapped */
+static inline int pattern_swap(int index) {
+	int swapped = 0;
+
+	for (int power = 1; index; index /= 3, power *= 3) {
+		swapped += (index % 3 == 0 ? 0 : 3 - index % 3) * power;
+	}
+	return swapped;
+}
+
+/* Fills tables [1] from tables [0] */
+static inline void pattern_swap_tables(void) {
+	for (int s = 0; s < PATTERN_STAGES; s++) {
+		for (int i = 0; i < EDGE_PATTERNS; i++) {
+			edge_table[1][s][i] = edge_table[0][s][pattern_swap(i)];
+			diagonal_table[1][s][i] = diagonal_table[0][s][pattern_swap(i)];
+		}
+		for (int i = 0; i < CORNER_PATTERNS; i++) {
+			corner_table[1][s][i] = corner_table[0][s][pattern_swap(i)];
+		}
+	}
+}
+
+static inline void pattern_init(void) {
+	for (int sq = 0; sq < 64; sq++) {
+		for (int w = 0; w < PATTERN_WORDS; w++) {
+			square_delta[sq][w] = 0;
+		}
+	}
+	// Same digit order as the bit tricks in pattern_evaluate()
+	for (int i = 0; i < 8; i++) {
+		pattern_square(0, i, 0, i);
+		pattern_square(1, i, 7, i);
+		pattern_square(2, i, i, 0);
+		pattern_square(3, i, i, 7);
+		pattern_square(FIRST_DIAGONAL, i, i, i);
+		pattern_square(FIRST_DIAGONAL + 1, i, 7 - i, i);
+	}
+	for (int r = 0; r < 3; r++) {
+		for (int c = 0; c < 3; c++) {
+			pattern_square(FIRST_CORNER, 3 * r + c, r, c);
+			pattern_square(FIRST_CORNER + 1, 3 * r + c, r, 7 - c);
+			pattern_square(FIRST_CORNER + 2, 3 * r + c, 7 - r, c);
+			pattern_square(FIRST_CORNER + 3, 3 * r + c, 7 - r, 7 - c);
+		}
+	}
+	for (int b = 0; b < 512; b++) {
+		base3[b] = 0;
+		for (int i = 8; i >= 0; i--) {
+			base3[b] = 3 * base3[b] + ((b >> i) & 1);
+		}
+	}
+	for (int s = 0; s < PATTERN_STAGES; s++) {
+		disc_weight[s] = DISC_WEIGHT[s];
+		for (int i = 0; i < EDGE_PATTERNS; i++) {
+			edge_table[0][s][i] = edge_score(s, i);
+			diagonal_table[0][s][i] = diagonal_score(i);
+		}
+		for (int i = 0; i < CORNER_PATTERNS; i++) {
+			corner_table[0][s][i] = corner_score(s, i);
+		}
+	}
+	pattern_swap_tables();
+}
+
+#endif
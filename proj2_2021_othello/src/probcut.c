@@ -0,0 +1,221 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Fits the Multi-ProbCut parameters in probcut.h.
+ *
+ *	ProbCut guesses the score of a deep search from a shallow one,
+ *	deep ~ a * shallow + b, and cuts a node off when even a generous
+ *	guess (sigma, the spread of the error, times a safety factor) lands
+ *	outside the window. This tool plays random games to collect positions
+ *	for each stage of the game, searches every one of them to each depth
+ *	with the same alpha-beta and evaluation as the player (including
+ *	player/weights.bin or OTHELLO_WEIGHTS, see weights.h), and fits a, b
+ *	and sigma by least squares for every depth and stage. The table goes
+ *	to stdout in the form of probcut.h.
+ *
+ *	The positions come from random games rather than from logs of the
+ *	player's searches. The player keeps no such logs, and searching each
+ *	position to every depth here gives the shallow and deep pairs with
+ *	exactly the alpha-beta the fit is for.
+ *
+ *	Usage: probcut [positions per stage] [max depth] [seed]
+ *	(defaults 100 10 2021)
+ *H***********************************************************************/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<time.h>
+
+#include "bitboard.h"
+#include "pattern.h"
+#include "weights.h"
+
+#define DEFAULT_POSITIONS 100
+#define DEFAULT_MAX_DEPTH 10
+#define MAX_FIT_DEPTH 14
+#define DEFAULT_SEED 2021
+/* The shallow search is this much shallower, or 2 plies below depth 6 */
+#define DEPTH_GAP 4
+#define MIN_DEPTH 3
+#define BIG 1000
+
+int positions = DEFAULT_POSITIONS;
+int max_depth = DEFAULT_MAX_DEPTH;
+unsigned long long nodes;
+
+int search(uint64_t P, uint64_t O, int depth, int alpha, int beta);
+int shallow_depth(int depth);
+int random_position(int stage, uint64_t *P, uint64_t *O);
+double now();
+
+int main(int argc, char *argv[]) {
+	static int scores[PATTERN_STAGES][1000][MAX_FIT_DEPTH + 1];
+	double sx, sy, sxx, sxy, a, b, e, var;
+	uint64_t P, O;
+	char *weights = getenv("OTHELLO_WEIGHTS");
+	double start;
+	int n, s;
+
+	if (argc > 1) positions = atoi(argv[1]);
+	if (argc > 2) max_depth = atoi(argv[2]);
+	srand(argc > 3 ? atoi(argv[3]) : DEFAULT_SEED);
+	if (positions < 10 || positions > 1000 || max_depth < MIN_DEPTH || max_depth > MAX_FIT_DEPTH) {
+		fprintf(stderr, "usage: probcut [positions per stage, 10..1000] [max depth, %d..%d] [seed]\n",
+				MIN_DEPTH, MAX_FIT_DEPTH);
+		return 2;
+	}
+
+	pattern_init();
+	// The player's weights if there are any, see weights.h
+	weights_load(weights ? weights : WEIGHTS_DEFAULT_PATH);
+	start = now();
+	for (int stage = 0; stage < PATTERN_STAGES; stage++) {
+		for (int i = 0; i < positions; i++) {
+			while (!random_position(stage, &P, &O)) {
+			}
+			for (int d = 1; d <= max_depth; d++) {
+				scores[stage][i][d] = search(P, O, d, -BIG, BIG);
+			}
+		}
+		fprintf(stderr, "stage %d done, %.1f s\n", stage, now() - start);
+	}
+
+	printf("/* vim: ai:sw=4:ts=4:sts:et */\n\n");
+	printf("/*H**********************************************************************\n");
+	printf(" *\n");
+	printf(" *\tMulti-ProbCut parameters, written by probcut.c (make probcut) from\n");
+	printf(" *\t%d positions per stage. For a search of depth d at stage s, a search\n", positions);
+	printf(" *\tof probcut_table[s][d].shallow predicts it as a * shallow + b, with\n");
+	printf(" *\tstandard error sigma. Entries with sigma 0 are not used.\n");
+	printf(" *H***********************************************************************/\n\n");
+	printf("#ifndef PROBCUT_H\n#define PROBCUT_H\n\n#include \"pattern.h\"\n\n");
+	printf("#define PROBCUT_MAX_DEPTH %d\n\n", max_depth);
+	printf("struct ProbCut {\n\tint shallow;\n\tdouble a;\n\tdouble b;\n\tdouble sigma;\n};\n\n");
+	printf("static const struct ProbCut probcut_table[PATTERN_STAGES][PROBCUT_MAX_DEPTH + 1] = {\n");
+	for (int stage = 0; stage < PATTERN_STAGES; stage++) {
+		printf("\t{\n");
+		for (int d = 0; d <= max_depth; d++) {
+			if (d < MIN_DEPTH) {
+				printf("\t\t{0, 0, 0, 0},\n");
+				continue;
+			}
+			s = shallow_depth(d);
+			n = positions;
+			sx = sy = sxx = sxy = 0;
+			for (int i = 0; i < n; i++) {
+				sx += scores[stage][i][s];
+				sy += scores[stage][i][d];
+				sxx += (double)scores[stage][i][s] * scores[stage][i][s];
+				sxy += (double)scores[stage][i][s] * scores[stage][i][d];
+			}
+			a = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+			b = (sy - a * sx) / n;
+			var = 0;
+			for (int i = 0; i < n; i++) {
+				e = scores[stage][i][d] - (a * scores[stage][i][s] + b);
+				var += e * e;
+			}
+			printf("\t\t{%d, %.3f, %.2f, %.2f},\n", s, a, b, sqrt(var / (n - 2)));
+		}
+		printf("\t},\n");
+	}
+	printf("};\n\n#endif\n");
+	fprintf(stderr, "%llu nodes, %.1f s\n", nodes, now() - start);
+	return 0;
+}
+
+int shallow_depth(int depth) {
+	return depth >= DEPTH_GAP + 2 ? depth - DEPTH_GAP : depth - 2;
+}
+
+/*
+	Negamax alpha-beta scored like the player's negamax(): a side with no
+	move is scored as it stands rather than passing. Moves are tried in
+	the order of their static score so the deeper fits finish in time.
+ */
+int search(uint64_t P, uint64_t O, int depth, int alpha, int beta) {
+	uint64_t moves, flips[64];
+	int squares[64], keys[64], n = 0, score, best = -BIG, j;
+
+	nodes++;
+	if (depth == 0) {
+		return pattern_evaluate(P, O);
+	}
+	moves = get_moves(P, O);
+	if (!moves) {
+		return pattern_evaluate(P, O);
+	}
+	for (; moves; moves &= moves - 1, n++) {
+		int sq = first_square(moves);
+		uint64_t f = get_flips(sq, P, O);
+		int key = depth > 2 ? pattern_evaluate(O & ~f, P | f | BIT(sq)) : 0;
+
+		for (j = n; j > 0 && keys[j - 1] > key; j--) {
+			squares[j] = squares[j - 1];
+			flips[j] = flips[j - 1];
+			keys[j] = keys[j - 1];
+		}
+		squares[j] = sq;
+		flips[j] = f;
+		keys[j] = key;
+	}
+	for (int i = 0; i < n; i++) {
+		score = -search(O & ~flips[i], P | flips[i] | BIT(squares[i]), depth - 1, -beta, -alpha);
+		if (score > best) {
+			best = score;
+			if (best > alpha) {
+				alpha = best;
+			}
+			if (alpha >= beta) {
+				break;
+			}
+		}
+	}
+	return best;
+}
+
+/*
+	Plays random moves from the start until the disc count falls in stage,
+	then returns 1 with P to move if P has a move there.
+ */
+int random_position(int stage, uint64_t *P, uint64_t *O) {
+	uint64_t p = BIT(SQUARE(3, 4)) | BIT(SQUARE(4, 3));
+	uint64_t o = BIT(SQUARE(3, 3)) | BIT(SQUARE(4, 4));
+	uint64_t moves, t;
+	int target = 4 + 16 * stage + rand() % 16, sq, k;
+
+	if (target > 60) {
+		target = 60;
+	}
+
+	while (popcount(p | o) < target) {
+		moves = get_moves(p, o);
+		if (!moves) {
+			if (!get_moves(o, p)) {
+				return 0;
+			}
+			t = p; p = o; o = t;
+			continue;
+		}
+		for (k = rand() % popcount(moves); k > 0; k--) {
+			moves &= moves - 1;
+		}
+		sq = first_square(moves);
+		t = get_flips(sq, p, o);
+		o &= ~t;
+		p |= t | BIT(sq);
+		t = p; p = o; o = t;
+	}
+	*P = p;
+	*O = o;
+	return get_moves(p, o) != 0;
+}
+
+double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
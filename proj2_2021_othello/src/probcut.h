@@ -0,0 +1,80 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Multi-ProbCut parameters, written by probcut.c (make probcut) from
+ *	300 positions per stage. For a search of depth d at stage s, a search
+ *	of probcut_table[s][d].shallow predicts it as a * shallow + b, with
+ *	standard error sigma. Entries with sigma 0 are not used.
+ *H***********************************************************************/
+
+#ifndef PROBCUT_H
+#define PROBCUT_H
+
+#include "pattern.h"
+
+#define PROBCUT_MAX_DEPTH 10
+
+struct ProbCut {
+	int shallow;
+	double a;
+	double b;
+	double sigma;
+};
+
+static const struct ProbCut probcut_table[PATTERN_STAGES][PROBCUT_MAX_DEPTH + 1] = {
+	{
+		{0, 0, 0, 0},
+		{0, 0, 0, 0},
+		{0, 0, 0, 0},
+		{1, 0.995, 1.12, 10.12},
+		{2, 0.987, -2.09, 7.37},
+		{3, 0.997, 2.50, 6.74},
+		{2, 1.025, -2.90, 9.93},
+		{3, 1.021, 3.67, 10.20},
+		{4, 1.056, -1.84, 9.87},
+		{5, 1.056, 2.27, 10.81},
+		{6, 1.067, -1.86, 9.42},
+	},
+	{
+		{0, 0, 0, 0},
+		{0, 0, 0, 0},
+		{0, 0, 0, 0},
+		{1, 0.959, -0.98, 18.78},
+		{2, 0.999, -2.65, 16.86},
+		{3, 1.038, -0.19, 17.16},
+		{2, 1.027, -2.64, 28.14},
+		{3, 1.088, 0.27, 27.47},
+		{4, 1.099, 1.30, 29.70},
+		{5, 1.098, 1.83, 30.68},
+		{6, 1.131, 1.86, 31.62},
+	},
+	{
+		{0, 0, 0, 0},
+		{0, 0, 0, 0},
+		{0, 0, 0, 0},
+		{1, 1.000, -2.73, 36.58},
+		{2, 0.999, 3.26, 38.16},
+		{3, 1.038, -1.19, 35.09},
+		{2, 1.030, 6.13, 62.55},
+		{3, 1.076, 0.47, 59.08},
+		{4, 1.145, 8.82, 57.91},
+		{5, 1.150, -3.72, 57.04},
+		{6, 1.183, 10.63, 58.91},
+	},
+	{
+		{0, 0, 0, 0},
+		{0, 0, 0, 0},
+		{0, 0, 0, 0},
+		{1, 1.072, -15.71, 82.20},
+		{2, 1.064, 26.14, 82.08},
+		{3, 1.074, -37.45, 77.65},
+		{2, 1.087, 39.29, 109.82},
+		{3, 1.083, -40.61, 104.52},
+		{4, 1.062, 21.79, 86.46},
+		{5, 1.036, -9.01, 77.64},
+		{6, 1.044, 20.48, 74.81},
+	},
+};
+
+#endif
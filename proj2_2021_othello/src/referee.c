@@ -0,0 +1,386 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Local referee, so matches can be played without the Java framework.
+ *
+ *	It plays the part of the server: for every game it listens on a free
+ *	local port, starts both players under mpirun with the same command
+ *	line the framework uses (ip, port, time limit, log file) and talks the
+ *	same protocol to them. A player gets its colour as one byte, then
+ *	messages with a two digit length in front: "gen_move", answered with
+ *	"xy\n" or "pass\n", "play_move xy" and finally "game_over". The
+ *	referee keeps its own board and a player forfeits the game if it plays
+ *	an illegal move, passes when it has a move, goes over the time limit by
+ *	more than TIME_GRACE or drops the connection.
+ *
+ *	The players swap colours every game. Each player runs in its own
+ *	directory, DIR/game<n>_<colour>, so their output.txt and stats.jsonl
+ *	files are kept.
+ *
+ *	Usage: referee [-n games] [-t seconds] [-p processes] [-d dir]
+ *			[-m mpirun command] player1 player2
+ *	(defaults 2 games, 4 seconds, 2 processes, matches, "mpirun")
+ *H***********************************************************************/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<limits.h>
+#include<signal.h>
+#include<time.h>
+#include<unistd.h>
+#include<poll.h>
+#include<sys/socket.h>
+#include<sys/stat.h>
+#include<sys/wait.h>
+#include<arpa/inet.h>
+
+#include "bitboard.h"
+
+#define DEFAULT_GAMES 2
+#define DEFAULT_TIME 4
+#define DEFAULT_PROCESSES 2
+#define DEFAULT_DIR "matches"
+#define DEFAULT_MPIRUN "mpirun"
+
+/* Seconds over the limit a reply may take before it counts as a loss */
+#define TIME_GRACE 0.5
+/* Seconds a player gets to start up and connect, and to exit after the game */
+#define CONNECT_TIMEOUT 60
+#define EXIT_TIMEOUT 10
+
+#define MAX_ARGS 32
+#define REPLY_SIZE 16
+
+struct Player {
+	const char *path;		/* absolute path of the binary */
+	const char *name;		/* as given on the command line */
+	pid_t pid;
+	int socket;
+	double max_time;		/* longest reply so far */
+};
+
+struct Result {
+	int discs[3];			/* by colour */
+	int forfeit;			/* colour that lost by breaking a rule, or 0 */
+	const char *reason;
+};
+
+int games = DEFAULT_GAMES;
+int time_limit = DEFAULT_TIME;
+int processes = DEFAULT_PROCESSES;
+const char *dir = DEFAULT_DIR;
+char *mpirun[MAX_ARGS];
+
+struct Result play_game(int game, struct Player *black, struct Player *white);
+int start_player(int listener, int port, struct Player *player, int colour, int game);
+void stop_player(struct Player *player);
+int send_message(struct Player *player, const char *text);
+int read_reply(struct Player *player, char *reply, double timeout);
+void split_command(char *command);
+double now();
+
+int main(int argc, char *argv[]) {
+	struct Player players[2];
+	struct Result result;
+	char mpirun_command[PATH_MAX] = DEFAULT_MPIRUN;
+	int wins[2] = {0, 0}, draws = 0, discs[2] = {0, 0};
+	int opt, first, winner;
+
+	while ((opt = getopt(argc, argv, "n:t:p:d:m:")) != -1) {
+		switch (opt) {
+			case 'n': games = atoi(optarg); break;
+			case 't': time_limit = atoi(optarg); break;
+			case 'p': processes = atoi(optarg); break;
+			case 'd': dir = optarg; break;
+			case 'm': snprintf(mpirun_command, sizeof(mpirun_command), "%s", optarg); break;
+			default: optind = argc + 1; break;
+		}
+	}
+	if (optind != argc - 2 || games < 1 || time_limit < 1 || processes < 1) {
+		fprintf(stderr, "usage: referee [-n games] [-t seconds] [-p processes] [-d dir]"
+				" [-m mpirun command] player1 player2\n");
+		return 2;
+	}
+	split_command(mpirun_command);
+
+	for (int i = 0; i < 2; i++) {
+		players[i].name = argv[optind + i];
+		players[i].path = realpath(argv[optind + i], NULL);
+		if (!players[i].path) {
+			perror(argv[optind + i]);
+			return 1;
+		}
+		players[i].max_time = 0;
+	}
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		perror(dir);
+		return 1;
+	}
+	// A player that dies must not take the referee with it
+	signal(SIGPIPE, SIG_IGN);
+
+	for (int game = 1; game <= games; game++) {
+		first = (game - 1) % 2;		// index of the player who is black
+		result = play_game(game, &players[first], &players[1 - first]);
+
+		if (result.forfeit) {
+			winner = result.forfeit == 1 ? 1 - first : first;
+		} else if (result.discs[1] != result.discs[2]) {
+			winner = result.discs[1] > result.discs[2] ? first : 1 - first;
+		} else {
+			winner = -1;
+		}
+		if (winner == -1) {
+			draws++;
+		} else {
+			wins[winner]++;
+		}
+		discs[first] += result.discs[1];
+		discs[1 - first] += result.discs[2];
+
+		printf("game %d: black %s %d, white %s %d", game, players[first].name,
+				result.discs[1], players[1 - first].name, result.discs[2]);
+		if (result.forfeit) {
+			printf(", %s forfeits (%s)", result.forfeit == 1 ? "black" : "white", result.reason);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	printf("%s %d, %s %d, draws %d; discs %d-%d; longest move %.2f s and %.2f s\n",
+			players[0].name, wins[0], players[1].name, wins[1], draws,
+			discs[0], discs[1], players[0].max_time, players[1].max_time);
+	return 0;
+}
+
+/*
+	Plays one game and leaves both players stopped. The board is kept from
+	black's point of view whoever is to move, so player/opponent in pos
+	always belong to colour pos.colour.
+ */
+struct Result play_game(int game, struct Player *black, struct Player *white) {
+	struct Result result = {{0, 0, 0}, 0, NULL};
+	struct Player *players[3] = {NULL, black, white};
+	struct Position pos;
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	char reply[REPLY_SIZE], message[REPLY_SIZE + 16];
+	uint64_t moves, flips;
+	double start, elapsed;
+	int listener, sq, started = 0;
+
+	black->socket = white->socket = -1;
+	black->pid = white->pid = -1;
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = 0;
+	if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0
+			|| listen(listener, 2) != 0
+			|| getsockname(listener, (struct sockaddr *)&address, &length) != 0) {
+		perror("listen");
+		exit(1);
+	}
+
+	// One at a time, so the player that connects is the one just started
+	if (start_player(listener, ntohs(address.sin_port), black, 1, game) == 0) {
+		started = 1;
+		if (start_player(listener, ntohs(address.sin_port), white, 2, game) == 0) {
+			started = 2;
+		}
+	}
+	close(listener);
+	if (started < 2) {
+		result.forfeit = started + 1;
+		result.reason = "did not connect";
+	}
+
+	pos.colour = 1;
+	pos.player = BIT(SQUARE(3, 4)) | BIT(SQUARE(4, 3));
+	pos.opponent = BIT(SQUARE(3, 3)) | BIT(SQUARE(4, 4));
+
+	while (!result.forfeit) {
+		moves = get_moves(pos.player, pos.opponent);
+		if (!moves && !get_moves(pos.opponent, pos.player)) {
+			break;
+		}
+
+		start = now();
+		if (send_message(players[pos.colour], "gen_move") != 0
+				|| read_reply(players[pos.colour], reply, time_limit + TIME_GRACE) != 0) {
+			result.forfeit = pos.colour;
+			result.reason = "no reply in time";
+			break;
+		}
+		elapsed = now() - start;
+		if (elapsed > players[pos.colour]->max_time) {
+			players[pos.colour]->max_time = elapsed;
+		}
+
+		if (strncmp(reply, "pass", 4) == 0) {
+			if (moves) {
+				result.forfeit = pos.colour;
+				result.reason = "passed with a move";
+				break;
+			}
+			position_pass(&pos);
+			strcpy(message, "play_move pass\n");
+		} else {
+			sq = SQUARE(reply[0] - '0', reply[1] - '0');
+			if (reply[0] < '0' || reply[0] > '7' || reply[1] < '0' || reply[1] > '7'
+					|| !(moves & BIT(sq))) {
+				result.forfeit = pos.colour;
+				result.reason = "illegal move";
+				break;
+			}
+			flips = get_flips(sq, pos.player, pos.opponent);
+			position_play(&pos, sq, flips);
+			snprintf(message, sizeof(message), "play_move %c%c", reply[0], reply[1]);
+		}
+		if (send_message(players[pos.colour], message) != 0) {
+			result.forfeit = pos.colour;
+			result.reason = "connection lost";
+		}
+	}
+
+	result.discs[pos.colour] = popcount(pos.player);
+	result.discs[3 - pos.colour] = popcount(pos.opponent);
+	stop_player(black);
+	stop_player(white);
+	return result;
+}
+
+/*
+	Starts player under mpirun in its own directory, waits for it to
+	connect and sends it its colour. Returns 0 once it is connected.
+ */
+int start_player(int listener, int port, struct Player *player, int colour, int game) {
+	char workdir[PATH_MAX], port_text[16], time_text[16], processes_text[16];
+	char *args[MAX_ARGS + 8];
+	char colour_text = '0' + colour;
+	struct pollfd connecting = {listener, POLLIN, 0};
+	int n = 0;
+
+	snprintf(workdir, sizeof(workdir), "%s/game%d_%s", dir, game, colour == 1 ? "black" : "white");
+	snprintf(port_text, sizeof(port_text), "%d", port);
+	snprintf(time_text, sizeof(time_text), "%d", time_limit);
+	snprintf(processes_text, sizeof(processes_text), "%d", processes);
+	if (mkdir(workdir, 0755) != 0 && errno != EEXIST) {
+		perror(workdir);
+		return -1;
+	}
+
+	for (int i = 0; mpirun[i]; i++) {
+		args[n++] = mpirun[i];
+	}
+	args[n++] = "-np";
+	args[n++] = processes_text;
+	args[n++] = (char *)player->path;
+	args[n++] = "127.0.0.1";
+	args[n++] = port_text;
+	args[n++] = time_text;
+	args[n++] = "output.txt";
+	args[n] = NULL;
+
+	player->pid = fork();
+	if (player->pid == 0) {
+		// Its own process group, so stop_player() can kill every rank
+		setpgid(0, 0);
+		if (chdir(workdir) != 0) {
+			_exit(127);
+		}
+		freopen("/dev/null", "w", stdout);
+		execvp(args[0], args);
+		_exit(127);
+	}
+	if (player->pid < 0) {
+		perror("fork");
+		return -1;
+	}
+
+	if (poll(&connecting, 1, CONNECT_TIMEOUT * 1000) <= 0) {
+		return -1;
+	}
+	player->socket = accept(listener, NULL, NULL);
+	if (player->socket < 0 || send(player->socket, &colour_text, 1, 0) != 1) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Tells the player the game is over and makes sure every rank has gone */
+void stop_player(struct Player *player) {
+	double until = now() + EXIT_TIMEOUT;
+	int status;
+
+	if (player->socket != -1) {
+		send_message(player, "game_over");
+	}
+	while (player->pid > 0 && waitpid(player->pid, &status, WNOHANG) == 0) {
+		if (now() > until) {
+			kill(-player->pid, SIGKILL);
+			waitpid(player->pid, &status, 0);
+			break;
+		}
+		usleep(10000);
+	}
+	if (player->socket != -1) {
+		close(player->socket);
+	}
+	player->socket = -1;
+	player->pid = -1;
+}
+
+/* Sends text with its two digit length in front */
+int send_message(struct Player *player, const char *text) {
+	char message[REPLY_SIZE + 32];
+	int length = snprintf(message, sizeof(message), "%02d%s", (int)strlen(text), text);
+
+	return send(player->socket, message, length, 0) == length ? 0 : -1;
+}
+
+/* Reads a reply up to its newline, giving up after timeout seconds */
+int read_reply(struct Player *player, char *reply, double timeout) {
+	struct pollfd reading = {player->socket, POLLIN, 0};
+	double until = now() + timeout;
+	int length = 0, got, wait_ms;
+
+	while (length == 0 || reply[length - 1] != '\n') {
+		wait_ms = (int)((until - now()) * 1000);
+		if (wait_ms <= 0 || poll(&reading, 1, wait_ms) <= 0) {
+			return -1;
+		}
+		got = recv(player->socket, reply + length, REPLY_SIZE - 1 - length, 0);
+		if (got <= 0) {
+			return -1;
+		}
+		length += got;
+		if (length == REPLY_SIZE - 1) {
+			break;
+		}
+	}
+	reply[length] = '\0';
+	return length >= 2 ? 0 : -1;
+}
+
+/* Splits the mpirun command on spaces into mpirun[] */
+void split_command(char *command) {
+	int n = 0;
+
+	for (char *word = strtok(command, " "); word && n < MAX_ARGS - 1; word = strtok(NULL, " ")) {
+		mpirun[n++] = word;
+	}
+	mpirun[n] = NULL;
+}
+
+double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,658 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Fits the evaluation tables of pattern.h to labelled positions and
+ *	writes them as a weight file (see weights.h) for the engines.
+ *
+ *	A positions file is a flat array of struct Sample: the two bitboards
+ *	with the side to move first, the final disc difference for it under
+ *	perfect play, of which only the sign is used, and the number of the
+ *	game the position comes from. Any source will
+ *	do; "generate" makes one from games played greedily on the hand
+ *	weights with some random moves, solved exactly (win/loss/draw) once
+ *	SOLVE_EMPTIES squares are left.
+ *
+ *	"fit" is logistic regression in the style of Texel tuning. The
+ *	probability of winning is taken as sigmoid(evaluation / scale), with
+ *	the scale fitted once to the starting weights so the tuned scores stay
+ *	in the units the search and probcut.h expect. Every table entry and
+ *	disc weight is then a parameter, fitted by full-batch gradient
+ *	descent (Adam) on the squared error, with the gradient summed over
+ *	the positions by all threads and a pull back towards the hand values.
+ *	Entries that the same position reaches through a board symmetry (an
+ *	edge or diagonal read from the other end, a corner region transposed)
+ *	are one parameter, so the tables stay symmetric like the hand ones and
+ *	book.h can keep one entry for all eight copies of a position.
+ *	Every VALIDATE_EVERY-th game is held out, whole, since the positions
+ *	of a game share its label, and the epoch that did best on those is
+ *	the one written. Entries no position uses keep their
+ *	hand value.
+ *
+ *	Usage: tune generate <positions> [games] [threads] [seed]
+ *	       tune fit <positions> <weights> [epochs] [threads]
+ *	(defaults 20000 games, 1000 epochs, one thread per core)
+ *H***********************************************************************/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<time.h>
+#include<pthread.h>
+#include<unistd.h>
+
+#include "bitboard.h"
+#include "pattern.h"
+#include "weights.h"
+
+#define DEFAULT_GAMES 20000
+#define DEFAULT_EPOCHS 1000
+#define DEFAULT_SEED 2021
+#define MAX_THREADS 64
+/* Generated games: random moves at first and now and then after that */
+#define RANDOM_PLIES 8
+#define RANDOM_PERCENT 10
+#define SOLVE_EMPTIES 14
+#define FASTEST_FIRST_EMPTIES 6
+/* Fit */
+#define VALIDATE_EVERY 10
+#define PATIENCE 20				/* epochs without a better validation error */
+#define LEARNING_RATE 1.0
+#define ADAM_BETA1 0.9
+#define ADAM_BETA2 0.999
+/* The hand weights count as this many positions agreeing with them, which
+   keeps entries that few positions use from running off */
+#define PRIOR_POSITIONS 50
+/* Table entries stay within +-WEIGHT_LIMIT and the disc weights within
+   +-DISC_LIMIT, so even the worst case of ten patterns and 64 discs stays
+   inside the player's search bounds (BIG and SMALL, +-1000) */
+#define WEIGHT_LIMIT 50
+#define DISC_LIMIT 7
+#define SEARCH_BOUND 1000
+
+#if PATTERN_COUNT * WEIGHT_LIMIT + 64 * DISC_LIMIT >= SEARCH_BOUND
+#error "WEIGHT_LIMIT and DISC_LIMIT allow scores outside the search bounds"
+#endif
+
+struct Sample {
+	uint64_t player;		/* to move */
+	uint64_t opponent;
+	int32_t score;			/* final disc difference for player */
+	int32_t game;			/* positions of one game share it */
+};
+
+/* A sample as the fit sees it: the pattern indices of pattern.h */
+struct Features {
+	uint16_t index[PATTERN_COUNT];
+	int8_t balance;			/* player's discs minus opponent's */
+	uint8_t stage;
+	uint8_t held_out;		/* from a validation game */
+	float target;			/* 1 win, 0.5 draw, 0 loss */
+};
+
+/* All parameters in one array, a table after the other */
+#define EDGE_OFFSET(s) ((s) * EDGE_PATTERNS)
+#define CORNER_OFFSET(s) (PATTERN_STAGES * EDGE_PATTERNS + (s) * CORNER_PATTERNS)
+#define DIAGONAL_OFFSET(s) (PATTERN_STAGES * (EDGE_PATTERNS + CORNER_PATTERNS) + (s) * EDGE_PATTERNS)
+#define DISC_OFFSET(s) (PATTERN_STAGES * (2 * EDGE_PATTERNS + CORNER_PATTERNS) + (s))
+#define PARAMETERS DISC_OFFSET(PATTERN_STAGES)
+
+/* What a thread gets to do, for generate or for one pass of the fit */
+struct Job {
+	pthread_t thread;
+	int id;
+	/* generate */
+	int games;
+	int first_game;			/* number of the job's first game */
+	uint64_t seed;
+	struct Sample *samples;
+	long count;
+	long capacity;
+	/* fit */
+	long first;
+	long last;
+	int validation;			/* the held out positions instead */
+	int gradient;			/* add to grad, else only measure */
+	double error;
+	long n;
+	float *grad;
+};
+
+struct Features *features;
+long feature_count;
+float *weights;
+double scale;
+
+int generate(const char *path, int games, int threads, uint64_t seed);
+void *play_games(void *arg);
+void play_game(struct Job *job, uint64_t *state, int game);
+int solve(uint64_t P, uint64_t O, int alpha, int beta, int passed);
+void add_sample(struct Job *job, uint64_t P, uint64_t O, int score, int game);
+int fit(const char *in, const char *out, int epochs, int threads);
+int load_features(const char *path);
+void *measure(void *arg);
+double run_jobs(struct Job *jobs, int threads, int validation, int gradient);
+double fit_scale(struct Job *jobs, int threads);
+void store_weights(const float *w);
+void find_twins(int *twin);
+int reverse_index(int index);
+int transpose_index(int index);
+float clamp_weight(long p, float w);
+uint64_t next_random(uint64_t *state);
+double now();
+
+int main(int argc, char *argv[]) {
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (threads < 1) threads = 1;
+	pattern_init();
+	if (argc >= 3 && strcmp(argv[1], "generate") == 0) {
+		if (argc > 4) threads = atoi(argv[4]);
+		if (threads < 1 || threads > MAX_THREADS) threads = 1;
+		return generate(argv[2], argc > 3 ? atoi(argv[3]) : DEFAULT_GAMES, threads,
+				argc > 5 ? strtoull(argv[5], NULL, 10) : DEFAULT_SEED);
+	}
+	if (argc >= 4 && strcmp(argv[1], "fit") == 0) {
+		if (argc > 5) threads = atoi(argv[5]);
+		if (threads < 1 || threads > MAX_THREADS) threads = 1;
+		return fit(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : DEFAULT_EPOCHS, threads);
+	}
+	fprintf(stderr, "usage: tune generate <positions> [games] [threads] [seed]\n"
+			"       tune fit <positions> <weights> [epochs] [threads]\n");
+	return 2;
+}
+
+/* Plays games on every thread and writes their positions to path */
+int generate(const char *path, int games, int threads, uint64_t seed) {
+	struct Job jobs[MAX_THREADS];
+	double start = now();
+	long total = 0;
+	FILE *out;
+
+	for (int t = 0; t < threads; t++) {
+		memset(&jobs[t], 0, sizeof(jobs[t]));
+		jobs[t].id = t;
+		jobs[t].games = games / threads + (t < games % threads);
+		jobs[t].first_game = t ? jobs[t - 1].first_game + jobs[t - 1].games : 0;
+		jobs[t].seed = (seed + 1) * 0x9E3779B97F4A7C15ULL + t;
+		pthread_create(&jobs[t].thread, NULL, play_games, &jobs[t]);
+	}
+	out = fopen(path, "wb");
+	for (int t = 0; t < threads; t++) {
+		pthread_join(jobs[t].thread, NULL);
+		if (out && fwrite(jobs[t].samples, sizeof(struct Sample), jobs[t].count, out)
+				!= (size_t)jobs[t].count) {
+			fclose(out);
+			out = NULL;
+		}
+		total += jobs[t].count;
+		free(jobs[t].samples);
+	}
+	if (!out || fclose(out) != 0) {
+		fprintf(stderr, "could not write %s\n", path);
+		return 1;
+	}
+	fprintf(stderr, "%d games, %ld positions, %.1f s\n", games, total, now() - start);
+	return 0;
+}
+
+void *play_games(void *arg) {
+	struct Job *job = arg;
+	uint64_t state = job->seed | 1;
+
+	for (int g = 0; g < job->games; g++) {
+		play_game(job, &state, job->first_game + g);
+	}
+	return NULL;
+}
+
+/*
+	One game, picking the move that leaves the opponent the lowest score
+	apart from the random ones. Positions before SOLVE_EMPTIES get the
+	result of the first solved one; those after are solved themselves.
+	Until then a sample holds +-1 for which side was to move.
+ */
+void play_game(struct Job *job, uint64_t *state, int game) {
+	uint64_t P = BIT(SQUARE(3, 4)) | BIT(SQUARE(4, 3));
+	uint64_t O = BIT(SQUARE(3, 3)) | BIT(SQUARE(4, 4));
+	uint64_t moves, flips, t;
+	long first = job->count;
+	int ply = 0, passes = 0, solved = 0, sign = 1, sq, k, score, best;
+
+	while (passes < 2) {
+		moves = get_moves(P, O);
+		if (!moves) {
+			passes++;
+			t = P; P = O; O = t;
+			sign = -sign;
+			continue;
+		}
+		passes = 0;
+
+		if (64 - popcount(P | O) <= SOLVE_EMPTIES) {
+			score = solve(P, O, -1, 1, 0);
+			if (!solved) {
+				// Label everything so far from this position's result
+				for (long i = first; i < job->count; i++) {
+					job->samples[i].score *= sign * score;
+				}
+				solved = 1;
+			}
+			add_sample(job, P, O, score, game);
+		} else {
+			add_sample(job, P, O, sign, game);
+		}
+
+		if (ply < RANDOM_PLIES || (int)(next_random(state) % 100) < RANDOM_PERCENT) {
+			for (k = next_random(state) % popcount(moves); k > 0; k--) {
+				moves &= moves - 1;
+			}
+			sq = first_square(moves);
+		} else {
+			sq = -1;
+			best = 100000;
+			for (; moves; moves &= moves - 1) {
+				int s = first_square(moves);
+
+				flips = get_flips(s, P, O);
+				score = pattern_evaluate(O & ~flips, P | flips | BIT(s));
+				if (score < best) {
+					best = score;
+					sq = s;
+				}
+			}
+		}
+		flips = get_flips(sq, P, O);
+		t = P | flips | BIT(sq);
+		P = O & ~flips;
+		O = t;
+		sign = -sign;
+		ply++;
+	}
+	// A game that ended before SOLVE_EMPTIES is labelled by its result
+	if (!solved) {
+		score = popcount(P) - popcount(O);
+		for (long i = first; i < job->count; i++) {
+			job->samples[i].score *= sign * score;
+		}
+	}
+}
+
+/*
+	Exact negamax of the disc difference for P. With the window (-1, 1)
+	it only tells win, draw and loss apart, which is all the labels need
+	and much faster. Moves leaving the opponent the fewest replies go first.
+ */
+int solve(uint64_t P, uint64_t O, int alpha, int beta, int passed) {
+	uint64_t moves = get_moves(P, O), flips[32];
+	int squares[32], keys[32], n = 0, best = -64, score, j;
+
+	if (!moves) {
+		if (passed) {
+			return popcount(P) - popcount(O);
+		}
+		return -solve(O, P, -beta, -alpha, 1);
+	}
+	for (; moves; moves &= moves - 1, n++) {
+		int sq = first_square(moves);
+		uint64_t f = get_flips(sq, P, O);
+		int key = 64 - popcount(P | O) > FASTEST_FIRST_EMPTIES
+			? popcount(get_moves(O & ~f, P | f | BIT(sq))) : 0;
+
+		for (j = n; j > 0 && keys[j - 1] > key; j--) {
+			squares[j] = squares[j - 1];
+			flips[j] = flips[j - 1];
+			keys[j] = keys[j - 1];
+		}
+		squares[j] = sq;
+		flips[j] = f;
+		keys[j] = key;
+	}
+	for (int i = 0; i < n; i++) {
+		score = -solve(O & ~flips[i], P | flips[i] | BIT(squares[i]), -beta, -alpha, 0);
+		if (score > best) {
+			best = score;
+			if (best > alpha) {
+				alpha = best;
+			}
+			if (alpha >= beta) {
+				break;
+			}
+		}
+	}
+	return best;
+}
+
+void add_sample(struct Job *job, uint64_t P, uint64_t O, int score, int game) {
+	if (job->count == job->capacity) {
+		job->capacity = job->capacity ? 2 * job->capacity : 4096;
+		job->samples = realloc(job->samples, job->capacity * sizeof(struct Sample));
+		if (!job->samples) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	job->samples[job->count].player = P;
+	job->samples[job->count].opponent = O;
+	job->samples[job->count].score = score;
+	job->samples[job->count].game = game;
+	job->count++;
+}
+
+int fit(const char *in, const char *out, int epochs, int threads) {
+	struct Job jobs[MAX_THREADS];
+	float *grad, *best, *hand, *m, *v;
+	int *twin;
+	double start = now(), train, validation, best_validation, step, prior;
+	int best_epoch = 0;
+
+	if (!load_features(in)) {
+		fprintf(stderr, "could not read %s\n", in);
+		return 1;
+	}
+	weights = calloc(PARAMETERS, sizeof(float));
+	best = calloc(PARAMETERS, sizeof(float));
+	hand = calloc(PARAMETERS, sizeof(float));
+	m = calloc(PARAMETERS, sizeof(float));
+	v = calloc(PARAMETERS, sizeof(float));
+	grad = calloc((size_t)threads * PARAMETERS, sizeof(float));
+	twin = malloc(PARAMETERS * sizeof(int));
+	if (!weights || !best || !hand || !m || !v || !grad || !twin) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	// Start from the hand weights
+	for (int s = 0; s < PATTERN_STAGES; s++) {
+		for (int i = 0; i < EDGE_PATTERNS; i++) {
+			weights[EDGE_OFFSET(s) + i] = edge_table[0][s][i];
+			weights[DIAGONAL_OFFSET(s) + i] = diagonal_table[0][s][i];
+		}
+		for (int i = 0; i < CORNER_PATTERNS; i++) {
+			weights[CORNER_OFFSET(s) + i] = corner_table[0][s][i];
+		}
+		weights[DISC_OFFSET(s)] = disc_weight[s];
+	}
+	// Hand values over the limits start at them, the fit never moves some
+	for (long p = 0; p < PARAMETERS; p++) {
+		weights[p] = clamp_weight(p, weights[p]);
+	}
+	memcpy(hand, weights, PARAMETERS * sizeof(float));
+	find_twins(twin);
+	for (int t = 0; t < threads; t++) {
+		memset(&jobs[t], 0, sizeof(jobs[t]));
+		jobs[t].id = t;
+		jobs[t].first = feature_count * t / threads;
+		jobs[t].last = feature_count * (t + 1) / threads;
+		jobs[t].grad = grad + (size_t)t * PARAMETERS;
+	}
+
+	scale = fit_scale(jobs, threads);
+	// The curvature of PRIOR_POSITIONS even positions' error at this scale
+	prior = PRIOR_POSITIONS * 2 * 0.25 * 0.25 / (scale * scale);
+	best_validation = run_jobs(jobs, threads, 1, 0);
+	memcpy(best, weights, PARAMETERS * sizeof(float));
+	fprintf(stderr, "%ld positions, scale %.1f, validation error %.5f, %.1f s\n",
+			feature_count, scale, best_validation, now() - start);
+
+	for (int epoch = 1; epoch <= epochs && epoch - best_epoch <= PATIENCE; epoch++) {
+		for (int t = 0; t < threads; t++) {
+			memset(jobs[t].grad, 0, PARAMETERS * sizeof(float));
+		}
+		train = run_jobs(jobs, threads, 0, 1);
+		step = LEARNING_RATE * sqrt(1 - pow(ADAM_BETA2, epoch)) / (1 - pow(ADAM_BETA1, epoch));
+		// A pair of twins is updated once, by p, with both their gradients
+		for (long p = 0; p < PARAMETERS; p++) {
+			float g = 0;
+			int copies = twin[p] == p ? 1 : 2;
+
+			if (twin[p] < p) {
+				continue;
+			}
+			for (int t = 0; t < threads; t++) {
+				g += jobs[t].grad[p];
+				if (copies == 2) {
+					g += jobs[t].grad[twin[p]];
+				}
+			}
+			if (g == 0 && m[p] == 0) {
+				continue;
+			}
+			g += copies * prior * (weights[p] - hand[p]);
+			m[p] = ADAM_BETA1 * m[p] + (1 - ADAM_BETA1) * g;
+			v[p] = ADAM_BETA2 * v[p] + (1 - ADAM_BETA2) * g * g;
+			weights[p] = clamp_weight(p, weights[p] - step * m[p] / (sqrt(v[p]) + 1e-12));
+			weights[twin[p]] = weights[p];
+		}
+		validation = run_jobs(jobs, threads, 1, 0);
+		if (validation < best_validation) {
+			best_validation = validation;
+			best_epoch = epoch;
+			memcpy(best, weights, PARAMETERS * sizeof(float));
+		}
+		if (epoch % 10 == 0) {
+			fprintf(stderr, "epoch %d train %.5f validation %.5f, %.1f s\n",
+					epoch, train, validation, now() - start);
+		}
+	}
+
+	store_weights(best);
+	if (!weights_save(out)) {
+		fprintf(stderr, "could not write %s\n", out);
+		return 1;
+	}
+	fprintf(stderr, "best epoch %d, validation error %.5f, written to %s, %.1f s\n",
+			best_epoch, best_validation, out, now() - start);
+	return 0;
+}
+
+/* Reads the samples in path into features */
+int load_features(const char *path) {
+	struct Sample sample;
+	struct PatternState st;
+	struct Features *f;
+	long size, held_out = 0;
+	FILE *in = fopen(path, "rb");
+
+	if (!in) {
+		return 0;
+	}
+	fseek(in, 0, SEEK_END);
+	size = ftell(in) / sizeof(struct Sample);
+	fseek(in, 0, SEEK_SET);
+	features = malloc((size + 1) * sizeof(struct Features));
+	if (!features) {
+		fclose(in);
+		return 0;
+	}
+	for (feature_count = 0; feature_count < size && fread(&sample, sizeof(sample), 1, in) == 1; ) {
+		f = &features[feature_count++];
+		pattern_state_init(&st, sample.player, sample.opponent);
+		for (int p = 0; p < PATTERN_COUNT; p++) {
+			f->index[p] = PATTERN_LANE(&st, p);
+		}
+		f->balance = st.balance;
+		f->stage = (st.discs - 4) >> 4;
+		f->target = sample.score > 0 ? 1 : sample.score == 0 ? 0.5 : 0;
+		f->held_out = sample.game % VALIDATE_EVERY == 0;
+		held_out += f->held_out;
+	}
+	fclose(in);
+	// Both sets need positions
+	return held_out > 0 && held_out < feature_count;
+}
+
+/*
+	The squared error of the win probabilities over the job's positions,
+	training or held out, and if asked its gradient in job->grad.
+ */
+void *measure(void *arg) {
+	struct Job *job = arg;
+	const struct Features *f;
+	const float *w = weights;
+	double error = 0, e, p, g;
+	long n = 0;
+
+	for (long i = job->first; i < job->last; i++) {
+		if (features[i].held_out != job->validation) {
+			continue;
+		}
+		f = &features[i];
+		e = w[DISC_OFFSET(f->stage)] * f->balance;
+		for (int k = 0; k < FIRST_CORNER; k++) {
+			e += w[EDGE_OFFSET(f->stage) + f->index[k]];
+		}
+		for (int k = FIRST_CORNER; k < FIRST_DIAGONAL; k++) {
+			e += w[CORNER_OFFSET(f->stage) + f->index[k]];
+		}
+		for (int k = FIRST_DIAGONAL; k < PATTERN_COUNT; k++) {
+			e += w[DIAGONAL_OFFSET(f->stage) + f->index[k]];
+		}
+		p = 1 / (1 + exp(-e / scale));
+		error += (p - f->target) * (p - f->target);
+		n++;
+		if (job->gradient) {
+			g = 2 * (p - f->target) * p * (1 - p) / scale;
+			job->grad[DISC_OFFSET(f->stage)] += g * f->balance;
+			for (int k = 0; k < FIRST_CORNER; k++) {
+				job->grad[EDGE_OFFSET(f->stage) + f->index[k]] += g;
+			}
+			for (int k = FIRST_CORNER; k < FIRST_DIAGONAL; k++) {
+				job->grad[CORNER_OFFSET(f->stage) + f->index[k]] += g;
+			}
+			for (int k = FIRST_DIAGONAL; k < PATTERN_COUNT; k++) {
+				job->grad[DIAGONAL_OFFSET(f->stage) + f->index[k]] += g;
+			}
+		}
+	}
+	job->error = error;
+	job->n = n;
+	return NULL;
+}
+
+/* Runs measure() on every thread and returns the mean error */
+double run_jobs(struct Job *jobs, int threads, int validation, int gradient) {
+	double error = 0;
+	long n = 0;
+
+	for (int t = 0; t < threads; t++) {
+		jobs[t].validation = validation;
+		jobs[t].gradient = gradient;
+		pthread_create(&jobs[t].thread, NULL, measure, &jobs[t]);
+	}
+	for (int t = 0; t < threads; t++) {
+		pthread_join(jobs[t].thread, NULL);
+		error += jobs[t].error;
+		n += jobs[t].n;
+	}
+	return n ? error / n : 0;
+}
+
+/* The scale that fits the starting weights best, by golden section search */
+double fit_scale(struct Job *jobs, int threads) {
+	const double ratio = (sqrt(5) - 1) / 2;
+	double lo = 1, hi = 500, a, b, fa, fb;
+
+	a = hi - ratio * (hi - lo);
+	b = lo + ratio * (hi - lo);
+	scale = a; fa = run_jobs(jobs, threads, 0, 0);
+	scale = b; fb = run_jobs(jobs, threads, 0, 0);
+	while (hi - lo > 0.5) {
+		if (fa < fb) {
+			hi = b; b = a; fb = fa;
+			a = hi - ratio * (hi - lo);
+			scale = a; fa = run_jobs(jobs, threads, 0, 0);
+		} else {
+			lo = a; a = b; fa = fb;
+			b = lo + ratio * (hi - lo);
+			scale = b; fb = run_jobs(jobs, threads, 0, 0);
+		}
+	}
+	return (lo + hi) / 2;
+}
+
+/* Rounds w into the [0] tables and rebuilds the [1] tables */
+void store_weights(const float *w) {
+	for (int s = 0; s < PATTERN_STAGES; s++) {
+		for (int i = 0; i < EDGE_PATTERNS; i++) {
+			edge_table[0][s][i] = lrintf(w[EDGE_OFFSET(s) + i]);
+			diagonal_table[0][s][i] = lrintf(w[DIAGONAL_OFFSET(s) + i]);
+		}
+		for (int i = 0; i < CORNER_PATTERNS; i++) {
+			corner_table[0][s][i] = lrintf(w[CORNER_OFFSET(s) + i]);
+		}
+		disc_weight[s] = lrintf(w[DISC_OFFSET(s)]);
+	}
+	pattern_swap_tables();
+}
+
+/*
+	twin[p] is the parameter p becomes when the board is mirrored or
+	transposed, p itself for symmetric patterns and the disc weights.
+ */
+void find_twins(int *twin) {
+	for (int s = 0; s < PATTERN_STAGES; s++) {
+		for (int i = 0; i < EDGE_PATTERNS; i++) {
+			twin[EDGE_OFFSET(s) + i] = EDGE_OFFSET(s) + reverse_index(i);
+			twin[DIAGONAL_OFFSET(s) + i] = DIAGONAL_OFFSET(s) + reverse_index(i);
+		}
+		for (int i = 0; i < CORNER_PATTERNS; i++) {
+			twin[CORNER_OFFSET(s) + i] = CORNER_OFFSET(s) + transpose_index(i);
+		}
+		twin[DISC_OFFSET(s)] = DISC_OFFSET(s);
+	}
+}
+
+/* An edge or diagonal index read from the other end */
+int reverse_index(int index) {
+	int v[8], reversed = 0;
+
+	for (int i = 0; i < 8; i++, index /= 3) {
+		v[i] = index % 3;
+	}
+	for (int i = 0; i < 8; i++) {
+		reversed = 3 * reversed + v[i];
+	}
+	return reversed;
+}
+
+/* A corner region index with rows and columns swapped */
+int transpose_index(int index) {
+	int v[9], transposed = 0;
+
+	for (int i = 0; i < 9; i++, index /= 3) {
+		v[i] = index % 3;
+	}
+	for (int r = 2; r >= 0; r--) {
+		for (int c = 2; c >= 0; c--) {
+			transposed = 3 * transposed + v[3 * c + r];
+		}
+	}
+	return transposed;
+}
+
+/* w held to the limit of parameter p */
+float clamp_weight(long p, float w) {
+	float limit = p >= DISC_OFFSET(0) ? DISC_LIMIT : WEIGHT_LIMIT;
+
+	return w > limit ? limit : w < -limit ? -limit : w;
+}
+
+/* xorshift64* */
+uint64_t next_random(uint64_t *state) {
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -25,36 +25,122 @@
  *	
  *	IMPORTANT NOTE:
  *		Any output that you would like to see (for debugging purposes) needs
- *		to be written to file. This can be done using file FP, and fprintf(),
- *		don't forget to flush the stream. 
- *		I would suggest writing a method to make this
- *		easier, I'll leave that to you.
+ *		to be written to file. This is done with log_info() and friends
+ *		(see log.h), which buffer in memory and write in the background:
+ *		rank 0 logs to output.txt and rank i to output_i.txt.
  *		The file name is passed as argv[4], feel free to change to whatever suits you.
  *H***********************************************************************/
 
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
+#include<math.h>
 #include<sys/socket.h>
 #include<arpa/inet.h>
 #include<mpi.h>
 #include<time.h>
 #include<assert.h>
+#include<pthread.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<poll.h>
+
+#include "bitboard.h"
+#include "pattern.h"
+#include "book.h"
+#include "log.h"
+#include "probcut.h"
+#include "mcts.h"
+#include "weights.h"
 
 #define ABP 1
 #define BIG 1000
 #define SMALL -1000
 
+/* Transposition table bound types */
+#define TT_EXACT 0
+#define TT_LOWER 1
+#define TT_UPPER 2
+#define TT_DEFAULT_MB 32
+#define MAX_DEPTH 60
+
+/*
+	Slots of the move stack. negamax() uses the slot of its remaining depth,
+	the root code uses the ones above MAX_DEPTH.
+ */
+#define LEVEL_SLOT (MAX_DEPTH + 1)
+#define WORKER_SLOT (MAX_DEPTH + 2)
+#define MOVE_STACK_SLOTS (MAX_DEPTH + 3)
+
+/* Message tags for handing out root moves, see run_level() */
+#define TAG_REQUEST 1
+#define TAG_ASSIGN 2
+/* Rank 0 checks for requests every POLL_INTERVAL nodes of its own search */
+#define POLL_INTERVAL 256
+
+/*
+	Commands from rank 0 to the workers, see receive_command(). Every one
+	carries the current position so a worker never has to ask for it.
+ */
+#define TAG_COMMAND 3
+#define CMD_SEARCH 1		/* search the position for my_colour */
+#define CMD_STOP 2			/* abandon the search in progress */
+#define CMD_POSITION 3		/* the game moved on, nothing to do yet */
+#define CMD_SHUTDOWN 4
+#define CMD_PONDER 5		/* search the opponent's replies until stopped */
+/* An idle worker checks for a command IDLE_SPINS times, then naps between checks */
+#define IDLE_SPINS 1000
+#define IDLE_NAP_NS 200000
+#define MAX_THREADS 64
+
+/* Pondering gives up on its own after this many seconds, see run_ponder() */
+#define PONDER_TIME_LIMIT 60.0
+
+/* Move ordering, see order_moves() */
+#define KILLERS 2
+#define TT_MOVE_ORDER (1 << 30)
+#define KILLER_ORDER (1 << 29)
+
+/* Per move statistics written by rank 0, see report_stats() */
+#define STATS_DEFAULT_PATH "stats.jsonl"
+
+/* Endgame solver, see solve() */
+#define ENDGAME_DEFAULT_EMPTIES 18
+/* Nodes in each rank's MCTS pool, 40 bytes each */
+#define MCTS_DEFAULT_NODES (1 << 21)
+/* Iterations between looks at the clock */
+#define MCTS_CHECK_INTERVAL 64
+#define FASTEST_FIRST_EMPTIES 6
+#define SOLVE_CHECK_INTERVAL 4096
+
 int DEPTH = 8;
-int change_depth = 0;
 int DEBUG = 1;
-double TIME = 3.85;
+/* Seconds per move if the server does not say, see plan_move() */
+int DEFAULT_TIME_LIMIT = 4;
+/* Kept back from the limit for the final gather, broadcasts and the reply */
+double TIME_MARGIN = 0.15;
+/* Iterative deepening starts no new depth after this share of the move time */
+double SOFT_FRACTION = 0.6;
+/* How much longer each depth takes than the one before, roughly */
+double MIDGAME_DEPTH_GROWTH = 3.0;
+double ENDGAME_DEPTH_GROWTH = 2.0;
+/* Below this many empties plus endgame_empties the tree is narrow enough for
+   the endgame growth */
+int NARROW_EMPTIES = 10;
+/* Share of the move time the endgame solver gets before falling back to minimax */
+double ENDGAME_TIME_FRACTION = 0.75;
+/* How many sigmas a ProbCut prediction has to clear the window by, 0 = off */
+double PROBCUT_CONFIDENCE = 3.0;
+/* ProbCut is only tried this many plies or more from the leaves */
+int PROBCUT_MIN_DEPTH = 7;
+/* Book moves searched shallower than this are weaker than what the search
+   itself reaches in the opening, so the search plays instead */
+int BOOK_MIN_DEPTH = 12;
 const int EMPTY = 0;
 const int BLACK = 1;
 const int WHITE = 2;
-const int OUTER = 3;
-const int ALLDIRECTIONS[8]={-11, -10, -9, -1, 1, 9, 10, 11};
-const int BOARDSIZE=100;
 const int IPBUFSIZE=16;
 const int LENBUFSIZE=3;
 const int MOVEBUFSIZE=6;
@@ -69,11 +155,121 @@ struct Node {
 	int score;
 	int alpha;
 	int beta;
-	int node_board[100];
+	struct Position node_board;
 };
 
 struct Node root = {NULL, NULL, -1, 0};
 
+/*
+	State of the root move hand out in run_level(), only used on rank 0.
+	bound is the best score any rank has finished with so far, from the
+	point of view of level_colour.
+ */
+struct Dispatch {
+	int *moves;
+	int next;
+	int bound;
+	int level_colour;
+	int finished;
+	int active;
+	int polls;
+};
+
+/* How long the move in hand may take, in seconds from its start */
+struct TimeBudget {
+	double soft;			/* no new depth starts after this */
+	double hard;			/* every search is abandoned here */
+	double solve;			/* the endgame solver gives up here */
+	double fallback;		/* soft for the search after a failed solve */
+	double growth;			/* expected time of a depth over the one before */
+};
+
+struct Command {
+	int type;
+	int colour;				/* my_colour */
+	struct Position board;
+	struct TimeBudget budget;
+};
+
+/*
+	Search counters of one thread. Helpers add theirs to pool.stats when
+	they finish a job and the main thread adds those to its own at the end
+	of the move; the times and the result are only kept by the main thread.
+ */
+struct SearchStats {
+	long nodes;				/* minimax() and solve() calls, or MCTS playouts */
+	long expanded;			/* minimax() nodes that searched their moves */
+	long cutoffs;			/* expanded nodes that failed high or low */
+	long probcuts;			/* nodes cut off by probcut() */
+	long first_cutoffs;		/* ... on the first move tried */
+	long tt_probes;
+	long tt_hits;			/* probes that found the position */
+	double search;			/* seconds spent searching root moves */
+	double sync;			/* seconds in barriers, gathers, broadcasts and waiting for root moves */
+	double total;			/* seconds in run_worker() */
+	int depth;				/* last depth completed, empties if solved */
+	int solved;
+	int score;				/* MCTS: win rate of the move in percent */
+};
+
+/*
+	Everything unmakemove() needs to take a move back: the square played,
+	the discs it flipped and whether the board had to be passed first.
+ */
+struct Undo {
+	uint64_t flips;
+	uint64_t hash;
+	int move;
+	int passed;
+	struct PatternState eval;
+};
+
+/*
+	Transposition table entry, shared by all search threads of a rank.
+	data packs the score (from the point of view of the side to move, like
+	everything negamax() returns), the remaining depth it was searched to, the
+	bound and the best move (-1 if none). check is key ^ data, so an entry
+	another thread was half way through writing never matches.
+ */
+struct TTEntry {
+	uint64_t check;
+	uint64_t data;
+};
+
+#define TT_SCORE(data) ((int)(int16_t)((data) & 0xFFFF))
+#define TT_DEPTH(data) ((int)(((data) >> 16) & 0xFF))
+#define TT_BOUND(data) ((int)(((data) >> 24) & 0xFF))
+#define TT_MOVE(data) ((int)(int8_t)(((data) >> 32) & 0xFF))
+
+/*
+	Helper threads for Lazy SMP. While the main thread of a rank searches a
+	root move, the helpers search the same position with their own boards
+	and fill the shared transposition table, which the main thread then
+	cuts off and orders moves with. A new job is posted by bumping
+	generation; stop tells the helpers to drop the current one. In MCTS
+	mode the job is to run iterations on mcts_tree instead.
+ */
+struct ThreadPool {
+	pthread_t threads[MAX_THREADS];
+	int count;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	int generation;
+	int busy;
+	int quit;
+	volatile int stop;
+	int mcts;					/* the job is MCTS, not minimax */
+	struct Position board;
+	uint64_t hash;
+	struct PatternState eval;
+	struct SearchStats stats;	/* what the helpers searched this move */
+	int depth;
+	int level_colour;
+	int alpha;
+	int beta;
+};
+
 void gen_move(char *move);
 void play_move(char *move);
 void game_over();
@@ -82,40 +278,118 @@ void initialise_board();
 void free_board();
 
 void legalmoves (int player, int *moves);
-int legalp (int move, int player);
-int validp (int move);
-int wouldflip (int move, int dir, int player);
 int opponent (int player);
-int findbracketingpiece(int square, int dir, int player);
 int minimax(int depth, int level_colour, int alpha, int beta);
-void makemove (int move, int player);
-void makeflips (int move, int dir, int player);
+int negamax(int depth, int alpha, int beta);
+int frontier();
+void order_moves(int *moves, int depth, int tt_move);
+void remember_cutoff(int depth, int move);
+void age_history();
+void clear_killers();
+int probcut(int depth, int alpha, int beta);
+void initialise_probcut();
+void initialise_mcts();
+int run_mcts();
+struct Undo makemove (int move, int player);
+struct Undo play(int move);
+void unmakemove (struct Undo undo);
 int get_loc(char* movestring);
 void get_move_string(int loc, char *ms);
 void printboard();
 char nameof(int piece);
-int count (int player, int * board);
+int piece_at (int sq);
+int count (int player);
 int potential_move_score(int move, int player); 
-void copy_array(int *source, int *dest, int length); 
 int evaluate(); 
+void reset_evaluation();
 int best_moves_index(int *moves, int colour); 
-int run_level(int *move, int *max, int level_colour, int alpha, int beta);
+int run_level(int *move, int *max, int level_colour, int alpha, int beta, int first);
+void initialise_tt();
+int tt_probe(int depth, int alpha, int beta, int *score, int *move);
+void tt_store(int depth, int bound, int score, int move);
+int tt_best_move();
+int tt_read(uint64_t *data);
+void initialise_threads();
+void free_threads();
+void *helper_main(void *arg);
+void helpers_start(int depth, int level_colour, int alpha, int beta);
+void helpers_stop();
+void helpers_start_mcts();
+double now();
+void initialise_endgame();
+void initialise_weights();
+void initialise_book();
+void free_book();
+int book_move();
+uint64_t my_moves();
+struct TimeBudget plan_move(int empties, int mobility);
+int solve_position(int alpha, int beta);
+int solve(uint64_t P, uint64_t O, int alpha, int beta, int empties);
+int solve_last(uint64_t P, uint64_t O, int sq);
+int game_score(uint64_t P, uint64_t O);
+int *move_list(int slot);
 void gather_moves_to_proc0(int *move, int *score, int level_colour);
+int search_root_move(int level_colour, int alpha, int beta, int full);
+int helped_minimax(int level_colour, int alpha, int beta);
+int dispatch_take();
+void dispatch_result(int score);
+void serve_requests(int block);
+void send_command(int type);
+void receive_command(struct Command *command);
+int stop_requested();
+void initialise_ponder();
+void run_ponder();
+void check_server();
+void worker_loop();
+void initialise_stats();
+void reset_stats();
+void add_stats(struct SearchStats *to, const struct SearchStats *from);
+void report_stats(int move);
+void write_stats(FILE *out, const struct SearchStats *s);
+double ratio(double a, double b);
 
 int my_colour;
-int time_limit;
+int time_limit = 0;
+struct TimeBudget budget;
 int running;
 int rank;
 int size;
-int *board;
+_Thread_local struct Position board;
 int firstrun = 1;
-FILE *fp;
-int graph_size = 0;
+_Thread_local struct SearchStats stats;
+FILE *stats_file = NULL;
 double start, finish;
-int enter = 0;
+struct Dispatch dispatch;
+struct Command pending;		/* read by stop_requested() but not a stop */
+int has_pending = 0;
+int stop_polls = 0;
+int ponder_enabled = 1;
+int pondering = 0;
+int ponder_stopped = 0;
+int ponder_move = -1;		/* the reply the last ponder expected, rank 0 */
+int server_socket = -1;
 int mm_score;
-int local_n;
 double wstart, wfinish;
+_Thread_local uint64_t hash_key;
+_Thread_local struct PatternState eval_state;	/* follows board, see makemove() */
+struct TTEntry *tt;
+uint64_t tt_mask;
+_Thread_local int timed_out = 0;
+double deadline;
+_Thread_local int *move_stack;
+_Thread_local int helper = 0;
+_Thread_local int probing = 0;		/* inside a ProbCut shallow search */
+_Thread_local int killers[MAX_DEPTH + 1][KILLERS];	/* by remaining depth */
+unsigned history[3][64];	/* by colour and square, shared by the threads */
+struct ThreadPool pool;
+int endgame_empties = ENDGAME_DEFAULT_EMPTIES;
+int solving = 0;
+int mcts_enabled = 0;
+struct MctsTree mcts_tree;	/* shared by the threads of a rank */
+_Thread_local uint64_t mcts_state;	/* playout random numbers */
+const struct BookEntry *book = NULL;	/* mapped opening book, rank 0 only */
+uint64_t book_count = 0;
+size_t book_bytes = 0;
 
 int main(int argc , char *argv[]) {
     int socket_desc, port, msg_len;
@@ -128,14 +402,33 @@ int main(int argc , char *argv[]) {
 
     struct sockaddr_in server;
 
-    /* starts MPI */
-    MPI_Init(&argc, &argv);
+    int provided;
+    char log_path[32];
+
+    /* starts MPI, only the main thread of each rank makes MPI calls */
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);	/* get current process id */
     MPI_Comm_size(MPI_COMM_WORLD, &size);	/* get number of processes */
 
     my_colour = EMPTY;
 
+    if (rank == 0) {
+        log_open("output.txt");
+    } else {
+        snprintf(log_path, sizeof(log_path), "output_%d.txt", rank);
+        log_open(log_path);
+    }
+
     initialise_board();
+    initialise_weights();
+    initialise_tt();
+    initialise_threads();
+    initialise_endgame();
+    initialise_book();
+    initialise_ponder();
+    initialise_stats();
+    initialise_probcut();
+    initialise_mcts();
 
     // Rank 0 is responsible for handling communication with the server
     if (rank == 0 && argc == 5){
@@ -143,14 +436,10 @@ int main(int argc , char *argv[]) {
         port = atoi(argv[2]);
         time_limit = atoi(argv[3]);
 
-        // fp = fopen(argv[4], "w");
-        fp = fopen("output.txt", "w");
-        fflush(fp);
-
         socket_desc = socket(AF_INET, SOCK_STREAM, 0);
         if (socket_desc == -1) {
-            fprintf(fp, "Could not create socket\n");
-            fflush(fp);
+            log_error("Could not create socket\n");
+            log_close();
             return -1;
         }
         server.sin_addr.s_addr = inet_addr(ip);
@@ -160,15 +449,15 @@ int main(int argc , char *argv[]) {
         //Connect to remote server
         if (connect(socket_desc, (struct sockaddr *)&server, sizeof(server)) < 0){
 
-            fprintf(fp, "Connect error\n");
-            fflush(fp);
+            log_error("Connect error\n");
+            log_close();
             return -1;
         }
-        fprintf(fp, "Connected\n");
-        fflush(fp);
+        log_info("Connected\n");
         if (socket_desc == -1){
             return 1;
         }
+        server_socket = socket_desc;
 
         while (running == 1){
             memset(len_buf, 0, LENBUFSIZE);
@@ -178,15 +467,12 @@ int main(int argc , char *argv[]) {
             if (firstrun == 1) {
                 char tempColour[2]; tempColour[1] = 0;
                 if(recv(socket_desc, tempColour , 1, 0) < 0){
-                    fprintf(fp,"Receive failed\n");
-                    fflush(fp);
+                    log_error("Receive failed\n");
                     running = 0;
                     break;
                 }
                 my_colour = atoi(tempColour);
-                fprintf(fp,"Player colour is: %d\n", my_colour);
-                fflush(fp);
-				MPI_Bcast(&my_colour, 1, MPI_INT, 0, MPI_COMM_WORLD);
+                log_info("Player colour is: %d\n", my_colour);
                 firstrun = 2;
             }
 
@@ -194,8 +480,7 @@ int main(int argc , char *argv[]) {
             if(recv(socket_desc, len_buf , 2, 0) < 0){
 
 
-                fprintf(fp,"Receive failed\n");
-                fflush(fp);
+                log_error("Receive failed\n");
                 running = 0;
                 break;
             }
@@ -204,8 +489,7 @@ int main(int argc , char *argv[]) {
 
 
             if(recv(socket_desc, msg_buf, msg_len, 0) < 0){
-                fprintf(fp,"Receive failed\n");
-                fflush(fp);
+                log_error("Receive failed\n");
                 running = 0;
                 break;
             }
@@ -216,10 +500,7 @@ int main(int argc , char *argv[]) {
 
             if (strcmp(cmd, "game_over") == 0){
                 running = -1;
-                fprintf(fp, "Game over\n");
-                fflush(fp);
-				MPI_Bcast(&running, 1, MPI_INT, 0, MPI_COMM_WORLD);
-				MPI_Bcast(&running, 1, MPI_INT, 0, MPI_COMM_WORLD);
+                log_info("Game over\n");
                 break;
 
             } else if (strcmp(cmd, "gen_move") == 0){
@@ -227,11 +508,13 @@ int main(int argc , char *argv[]) {
                 gen_move(my_move);
                 if (send(socket_desc, my_move, strlen(my_move) , 0) < 0){
                     running = 0;
-                    fprintf(fp,"Move send failed\n");
-                    fflush(fp);
+                    log_error("Move send failed\n");
                     break;
                 }
                 printboard();
+                // Think on the opponent's time until the server speaks again
+                send_command(CMD_PONDER);
+                run_ponder();
             } else if (strcmp(cmd, "play_move") == 0){
     		// Add the opponent's move to my board 
                 opponent_move = strtok(NULL, " ");
@@ -240,23 +523,12 @@ int main(int argc , char *argv[]) {
 
             }
         }
+        // However the game ended, the workers are waiting for a command
+        send_command(CMD_SHUTDOWN);
     } else {
     	// Rank i (i != 0) calls run_worker to make its move 
-		MPI_Bcast(&my_colour, 1, MPI_INT, 0, MPI_COMM_WORLD);
-		fp = fopen("output.txt", "a");
-
-		while(1) {
-			MPI_Bcast(&enter, 1, MPI_INT, 0, MPI_COMM_WORLD);
-			fprintf(fp, "Proc %d enter = %d\n", rank, enter);
-			if (enter == 1) {
-				run_worker();
-				enter = 0;
-			} else if (enter == -1) {
-				break;
-			}
-		}
+		worker_loop();
     }
-	fclose(fp);
     game_over();
 }
 
@@ -264,18 +536,424 @@ int main(int argc , char *argv[]) {
 	Called at the start of execution on all ranks
  */
 void initialise_board(){
-    int i;
     running = 1;
-    board = (int *)malloc(BOARDSIZE * sizeof(int));
-    for (i = 0; i<=9; i++) board[i]=OUTER;
-    for (i = 10; i<=89; i++) {
-        if (i%10 >= 1 && i%10 <= 8) board[i]=EMPTY; else board[i]=OUTER;
-    }
-    for (i = 90; i<=99; i++) board[i]=OUTER;
-    board[44]=WHITE; board[45]=BLACK; board[54]=BLACK; board[55]=WHITE;
+    board.colour = BLACK;
+    board.player = BIT(SQUARE(3, 4)) | BIT(SQUARE(4, 3));
+    board.opponent = BIT(SQUARE(3, 3)) | BIT(SQUARE(4, 4));
+    zobrist_init();
+    pattern_init();
+    hash_key = zobrist_hash(&board);
+    reset_evaluation();
+    clear_killers();
+    move_stack = (int *)malloc(MOVE_STACK_SLOTS * LEGALMOVSBUFSIZE * sizeof(int));
 }
 void free_board(){
-   free(board);
+    free(tt);
+    free(mcts_tree.nodes);
+    free(move_stack);
+}
+
+/*
+	Move lists live in one block allocated at start up, one list per slot,
+	so the search never has to call malloc.
+ */
+int *move_list(int slot) {
+	return move_stack + slot * LEGALMOVSBUFSIZE;
+}
+
+/*
+	Allocates the transposition table on every rank. The size in megabytes
+	comes from the OTHELLO_TT_MB environment variable so it can be fitted
+	to the memory available per rank, and is rounded down to a power of two
+	number of entries.
+ */
+void initialise_tt(){
+	char *env = getenv("OTHELLO_TT_MB");
+	uint64_t mb = TT_DEFAULT_MB;
+	uint64_t entries = 1;
+
+	if (env && atoi(env) > 0) {
+		mb = atoi(env);
+	}
+	while (entries * 2 * sizeof(struct TTEntry) <= mb << 20) {
+		entries *= 2;
+	}
+	tt = NULL;
+	while (!tt && entries > 1) {
+		tt = calloc(entries, sizeof(struct TTEntry));
+		if (!tt) {
+			entries /= 2;
+		}
+	}
+	tt_mask = entries - 1;
+}
+
+/*
+	Reads the entry for the current position into data. Returns 0 if the
+	slot holds some other position.
+ */
+int tt_read(uint64_t *data) {
+	struct TTEntry *entry = &tt[hash_key & tt_mask];
+	uint64_t check = __atomic_load_n(&entry->check, __ATOMIC_RELAXED);
+
+	*data = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+	return (check ^ *data) == hash_key;
+}
+
+/*
+	Looks the current position up. Fills in the stored best move whenever
+	the position is found and returns 1 if the stored score is deep and
+	tight enough to be returned without searching.
+ */
+int tt_probe(int depth, int alpha, int beta, int *score, int *move) {
+	uint64_t data;
+	int bound;
+
+	stats.tt_probes++;
+	if (!tt_read(&data)) {
+		return 0;
+	}
+	stats.tt_hits++;
+	*move = TT_MOVE(data);
+	if (TT_DEPTH(data) < depth) {
+		return 0;
+	}
+	*score = TT_SCORE(data);
+	bound = TT_BOUND(data);
+	if (bound == TT_EXACT
+		|| (bound == TT_LOWER && *score >= beta)
+		|| (bound == TT_UPPER && *score <= alpha)) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Best move stored for the current position, -1 if there is none */
+int tt_best_move() {
+	uint64_t data;
+
+	if (!tt_read(&data)) {
+		return -1;
+	}
+	return TT_MOVE(data);
+}
+
+/*
+	Stores the current position, keeping a deeper entry for the same
+	position over a shallower one.
+ */
+void tt_store(int depth, int bound, int score, int move) {
+	struct TTEntry *entry = &tt[hash_key & tt_mask];
+	uint64_t data;
+
+	if (tt_read(&data) && TT_DEPTH(data) > depth) {
+		return;
+	}
+	data = (uint64_t)(uint16_t)score
+		| (uint64_t)(uint8_t)depth << 16
+		| (uint64_t)(uint8_t)bound << 24
+		| (uint64_t)(uint8_t)move << 32;
+	__atomic_store_n(&entry->check, hash_key ^ data, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->data, data, __ATOMIC_RELAXED);
+}
+
+/*
+	Starts the helper threads. OTHELLO_THREADS is the number of search
+	threads per rank including the main one, so 1 (the default) means no
+	helpers at all.
+ */
+void initialise_threads(){
+	char *env = getenv("OTHELLO_THREADS");
+	int threads = 1;
+
+	if (env && atoi(env) > 0) {
+		threads = atoi(env);
+	}
+	if (threads > MAX_THREADS) {
+		threads = MAX_THREADS;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.wake, NULL);
+	pthread_cond_init(&pool.idle, NULL);
+	pool.count = 0;
+	for (int i = 1; i < threads; i++) {
+		if (pthread_create(&pool.threads[pool.count], NULL, helper_main, (void *)(intptr_t)i) == 0) {
+			pool.count++;
+		}
+	}
+}
+
+void free_threads(){
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = 1;
+	pool.stop = 1;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+	for (int i = 0; i < pool.count; i++) {
+		pthread_join(pool.threads[i], NULL);
+	}
+}
+
+/*
+	Helper thread loop: wait for a job, search it on a private copy of the
+	board and throw the result away, the table already has it. Odd helpers
+	go one ply deeper so the threads do not all follow the same path.
+ */
+void *helper_main(void *arg) {
+	int id = (int)(intptr_t)arg;
+	int seen = 0;
+	int depth, level_colour, alpha, beta;
+
+	helper = 1;
+	clear_killers();
+	mcts_state = 0x9E3779B97F4A7C15ULL * (uint64_t)(rank * MAX_THREADS + id + 1);
+	move_stack = (int *)malloc(MOVE_STACK_SLOTS * LEGALMOVSBUFSIZE * sizeof(int));
+
+	pthread_mutex_lock(&pool.lock);
+	while (1) {
+		while (pool.generation == seen && !pool.quit) {
+			pthread_cond_wait(&pool.wake, &pool.lock);
+		}
+		if (pool.quit) {
+			break;
+		}
+		seen = pool.generation;
+		if (pool.stop) {
+			continue;
+		}
+		board = pool.board;
+		hash_key = pool.hash;
+		eval_state = pool.eval;
+		depth = pool.depth + (id & 1);
+		level_colour = pool.level_colour;
+		alpha = pool.alpha;
+		beta = pool.beta;
+		pool.busy++;
+		pthread_mutex_unlock(&pool.lock);
+
+		timed_out = 0;
+		if (depth > MAX_DEPTH) {
+			depth = MAX_DEPTH;
+		}
+		if (pool.mcts) {
+			while (!pool.stop) {
+				mcts_iterate(&mcts_tree, &mcts_state);
+				stats.nodes++;
+			}
+		} else {
+			minimax(depth, level_colour, alpha, beta);
+		}
+
+		pthread_mutex_lock(&pool.lock);
+		add_stats(&pool.stats, &stats);
+		memset(&stats, 0, sizeof(stats));
+		pool.busy--;
+		if (pool.busy == 0) {
+			pthread_cond_broadcast(&pool.idle);
+		}
+	}
+	pthread_mutex_unlock(&pool.lock);
+	free(move_stack);
+	return NULL;
+}
+
+/* Sets the helpers searching the current board */
+void helpers_start(int depth, int level_colour, int alpha, int beta) {
+	if (pool.count == 0) {
+		return;
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.board = board;
+	pool.eval = eval_state;
+	pool.hash = hash_key;
+	pool.depth = depth;
+	pool.level_colour = level_colour;
+	pool.alpha = alpha;
+	pool.beta = beta;
+	pool.mcts = 0;
+	pool.stop = 0;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/* Sets the helpers running MCTS iterations on mcts_tree */
+void helpers_start_mcts() {
+	if (pool.count == 0) {
+		return;
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.mcts = 1;
+	pool.stop = 0;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/* Stops the helpers and waits until all of them are idle again */
+void helpers_stop() {
+	if (pool.count == 0) {
+		return;
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.stop = 1;
+	while (pool.busy > 0) {
+		pthread_cond_wait(&pool.idle, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/*
+	OTHELLO_ENDGAME_EMPTIES sets how many empty squares are left when
+	run_worker() switches from minimax to the exact solver, 0 turns the
+	solver off.
+ */
+void initialise_endgame(){
+	char *env = getenv("OTHELLO_ENDGAME_EMPTIES");
+
+	if (env) {
+		endgame_empties = atoi(env);
+	}
+}
+
+/*
+	Every rank evaluates, so every rank loads the tuned weights (see
+	weights.h and tune.c). OTHELLO_WEIGHTS overrides the path; without a
+	readable file the hand weights of pattern.h stay.
+ */
+void initialise_weights(){
+	char *path = getenv("OTHELLO_WEIGHTS");
+
+	if (!path) {
+		path = WEIGHTS_DEFAULT_PATH;
+	}
+	if (weights_load(path)) {
+		log_info("Weights loaded from %s\n", path);
+	}
+}
+
+/*
+	Maps the opening book (see book.h) on rank 0. OTHELLO_BOOK overrides
+	the path; without a readable book the player just searches every move.
+ */
+void initialise_book(){
+	char *path = getenv("OTHELLO_BOOK");
+	const struct BookHeader *header;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (rank != 0) {
+		return;
+	}
+	if (!path) {
+		path = BOOK_DEFAULT_PATH;
+	}
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct BookHeader)) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			header = map;
+			if (header->magic == BOOK_MAGIC && header->count
+					== (st.st_size - sizeof(struct BookHeader)) / sizeof(struct BookEntry)) {
+				book = (const struct BookEntry *)(header + 1);
+				book_count = header->count;
+				book_bytes = st.st_size;
+			} else {
+				munmap(map, st.st_size);
+			}
+		}
+	}
+	close(fd);
+}
+
+void free_book(){
+	if (book) {
+		munmap((void *)((const struct BookHeader *)book - 1), book_bytes);
+		book = NULL;
+	}
+}
+
+/*
+	The book move for the current position if it has a legal one found at
+	BOOK_MIN_DEPTH or deeper, else -1
+ */
+int book_move(){
+	uint64_t mine = board.player, theirs = board.opponent;
+	int move, score, depth;
+
+	if (!book) {
+		return -1;
+	}
+	if (board.colour != my_colour) {
+		// The opponent passed
+		mine = board.opponent; theirs = board.player;
+	}
+	move = book_probe(book, book_count, mine, theirs, &score, &depth);
+	if (move == -1 || !(my_moves() & BIT(move))) {
+		return -1;
+	}
+	if (depth < BOOK_MIN_DEPTH) {
+		log_info("Book move %d is from depth %d only, searching instead\n", move, depth);
+		return -1;
+	}
+	log_info("Book move %d score %d depth %d\n", move, score, depth);
+	return move;
+}
+
+/* My legal moves, also right after the opponent passed */
+uint64_t my_moves(){
+	if (board.colour == my_colour) {
+		return get_moves(board.player, board.opponent);
+	}
+	return get_moves(board.opponent, board.player);
+}
+
+/*
+	Time management. The server gives every move the same limit (argv[3],
+	whole seconds), so there is nothing to save up for later and the job
+	is to use as much of each move as can be used well. Everything is
+	measured from the start of the move on each rank and TIME_MARGIN is
+	left over for the MPI traffic after the search and the reply itself.
+
+	Iterative deepening stops starting new depths once the next one is
+	not expected to finish in time, going by how long the last one took
+	times the growth for this stage of the game, and in any case after
+	the soft limit. With only a few moves to choose from a depth costs
+	less, so it counts as narrow too.
+
+	An endgame solve that runs out of time leaves what is left after
+	solve to the normal search, which gets the soft share of that, so
+	the two are planned together rather than both against the whole move.
+ */
+struct TimeBudget plan_move(int empties, int mobility){
+	struct TimeBudget plan;
+	double limit = time_limit > 0 ? time_limit : DEFAULT_TIME_LIMIT;
+
+	plan.hard = limit - TIME_MARGIN;
+	if (plan.hard < limit / 2) {
+		plan.hard = limit / 2;
+	}
+	plan.soft = plan.hard * SOFT_FRACTION;
+	plan.solve = plan.hard * ENDGAME_TIME_FRACTION;
+	plan.fallback = plan.solve + (plan.hard - plan.solve) * SOFT_FRACTION;
+	if (empties <= endgame_empties + NARROW_EMPTIES || mobility <= 3) {
+		plan.growth = ENDGAME_DEPTH_GROWTH;
+	} else {
+		plan.growth = MIDGAME_DEPTH_GROWTH;
+	}
+	return plan;
+}
+
+/* Wall clock time that is safe to read from any thread, unlike MPI_Wtime */
+double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
 /*
@@ -289,71 +967,199 @@ void free_board(){
 // *********************************************************************
 int run_worker(){
 
-	int *moves, move, score, alpha, beta, index;
-	int tmp_board[BOARDSIZE];
-    moves = (int *)malloc(LEGALMOVSBUFSIZE * sizeof(int));
-	memset(moves, 0, LEGALMOVSBUFSIZE);
+	int *moves, move, score, alpha, beta, index, depth, empties;
+	int best_move, pv_move;
+	int any_timed_out;
+	double move_deadline, elapsed, last_elapsed = 0, move_start, sync_start, soft = budget.soft;
+	int decision[2];
+	struct Undo undo;
+	moves = move_list(WORKER_SLOT);
 	move = -1;
 	score = 0;
 
-	if (!fp) {
-		fp = fopen("output.txt", "a");
-	}
-	MPI_Bcast(board, BOARDSIZE, MPI_INT, 0, MPI_COMM_WORLD);
-	copy_array(board, tmp_board, BOARDSIZE);
-
 	wstart = MPI_Wtime();
+	reset_stats();
+	age_history();
+	move_start = now();
+	move_deadline = move_start + budget.hard;
+	deadline = move_deadline;
+	empties = 64 - popcount(board.player | board.opponent);
 
 	legalmoves(my_colour, moves);
 
+	// Until an iteration completes the best move is the best looking one
 	index = best_moves_index(moves, my_colour);
-	makemove(moves[index], my_colour);
+	best_move = index != -1 ? moves[index] : -1;
+
+	// Close to the end solve exactly, and only search if that takes too long
+	if (empties <= endgame_empties && best_move != -1) {
+		timed_out = 0;
+		solving = 1;
+		deadline = now() + budget.solve;
+		DEBUG = 1;
+		move = -1;
 
-	DEPTH--;
-	alpha = SMALL;
-	beta = BIG;
-	DEBUG = 0;
-	TIME = 0.95;
+		run_level(&move, &score, my_colour, SMALL, BIG, best_move);
+		sync_start = now();
+		MPI_Barrier(MPI_COMM_WORLD);
+		gather_moves_to_proc0(&move, &score, my_colour);
+		MPI_Allreduce(&timed_out, &any_timed_out, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+		stats.sync += now() - sync_start;
+
+		solving = 0;
+		deadline = move_deadline;
+		if (rank == 0) {
+			decision[0] = !any_timed_out;
+			decision[1] = move;
+			log_info("Endgame solve with %d empties %s in %f, move = %d, score = %d\n",
+					empties, any_timed_out ? "timed out" : "done",
+					MPI_Wtime() - wstart, move, score);
+		}
+		MPI_Bcast(decision, 2, MPI_INT, 0, MPI_COMM_WORLD);
+		if (decision[0] && decision[1] != -1) {
+			stats.depth = empties;
+			stats.solved = 1;
+			stats.score = score;
+			stats.total = now() - move_start;
+			return decision[1];
+		}
+		// The search gets what the solve left, see plan_move(), and its
+		// first depth is timed from here
+		last_elapsed = MPI_Wtime() - wstart;
+		soft = budget.fallback;
+	}
 
-	run_level(&move, &score, opponent(my_colour), alpha, beta);
-	MPI_Barrier(MPI_COMM_WORLD);
-	gather_moves_to_proc0(&move, &score, opponent(my_colour));
+	if (mcts_enabled && best_move != -1) {
+		move = run_mcts();
+		stats.total = now() - move_start;
+		return move != -1 ? move : best_move;
+	}
 
-	alpha = score;
-	MPI_Bcast(&alpha, 1, MPI_INT, 0, MPI_COMM_WORLD);
-	DEPTH++;
-	copy_array(tmp_board, board, BOARDSIZE);
+	for (depth = 1; depth <= MAX_DEPTH && best_move != -1; depth++) {
+		timed_out = 0;
 
-	move = -1;
-	score = 0;
+		// Phase 1: search the previous best move to get an alpha
+		pv_move = best_move;
+		undo = makemove(pv_move, my_colour);
 
-	fclose(fp);
-	fp = fopen("output.txt", "a");
+		DEPTH = depth - 1;
+		alpha = SMALL;
+		beta = BIG;
+		DEBUG = 0;
+		move = -1;
 
-	DEBUG = 1;
-	TIME = 2.95;
-	move = -1;
-	score = 0;
+		run_level(&move, &score, opponent(my_colour), alpha, beta, tt_best_move());
+		sync_start = now();
+		MPI_Barrier(MPI_COMM_WORLD);
+		gather_moves_to_proc0(&move, &score, opponent(my_colour));
+
+		// One below so that moves as good as the pv move are not cut off.
+		// If the opponent has to pass there is no bound to share.
+		alpha = move == -1 ? SMALL : score - 1;
+		MPI_Bcast(&alpha, 1, MPI_INT, 0, MPI_COMM_WORLD);
+		stats.sync += now() - sync_start;
+		unmakemove(undo);
+
+		// Phase 2: all root moves against that alpha, pv move first
+		DEPTH = depth;
+		DEBUG = 1;
+		move = -1;
 
-	run_level(&move, &score, (my_colour), alpha, beta);
-	MPI_Barrier(MPI_COMM_WORLD);
-	gather_moves_to_proc0(&move, &score, (my_colour));
-	
-	wfinish = MPI_Wtime();
+		run_level(&move, &score, (my_colour), alpha, beta, pv_move);
+		sync_start = now();
+		MPI_Barrier(MPI_COMM_WORLD);
+		gather_moves_to_proc0(&move, &score, (my_colour));
+
+		// An iteration only counts if no rank ran out of time in it
+		MPI_Allreduce(&timed_out, &any_timed_out, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+		stats.sync += now() - sync_start;
+		if (!any_timed_out) {
+			stats.depth = depth;
+			stats.score = score;
+		}
 
-	if (wfinish - wstart < 2) {
-		DEPTH++;
-	} else if (wfinish - wstart > 3.9) {
-		DEPTH--;
-	}
-	if (rank == 0) {
-		fprintf(fp, "DEPTH of proc 0 = %d\n", DEPTH);
+		if (rank == 0) {
+			wfinish = MPI_Wtime();
+			elapsed = wfinish - wstart;
+			decision[0] = !any_timed_out
+				&& depth < empties
+				&& elapsed < soft
+				&& elapsed + (elapsed - last_elapsed) * budget.growth < budget.hard;
+			last_elapsed = elapsed;
+			decision[1] = any_timed_out || move == -1 ? best_move : move;
+			if (!any_timed_out) {
+				log_info("Depth %d done in %f, move = %d, score = %d\n",
+						depth, wfinish - wstart, decision[1], score);
+			}
+		}
+		sync_start = now();
+		MPI_Bcast(decision, 2, MPI_INT, 0, MPI_COMM_WORLD);
+		stats.sync += now() - sync_start;
+		best_move = decision[1];
+		if (!decision[0]) {
+			break;
+		}
 	}
 
-	if (move == 0) {
-		move = -1;
+	stats.total = now() - move_start;
+	return best_move;
+}
+
+/*
+	Monte Carlo tree search of my move, run by every rank instead of the
+	iterative deepening when OTHELLO_SEARCH=mcts. Each rank grows its own
+	tree with all of its threads (see mcts.h) until the hard limit; then
+	the visits and scores of the root moves are summed over the ranks at
+	rank 0, which picks the most visited move and tells the others.
+	Returns -1 if no rank got as far as expanding the root.
+ */
+int run_mcts(){
+	struct MctsNode *root = &mcts_tree.nodes[0], *child;
+	uint64_t mine = board.player, theirs = board.opponent;
+	int counts[128] = {0}, totals[128];		// visits by square, then scores
+	int decision[2], best = 0, playouts = 0;
+	double sync_start, search_start = now();
+	long i;
+
+	if (board.colour != my_colour) {
+		// The opponent passed
+		mine = board.opponent; theirs = board.player;
 	}
-	return move;
+	mcts_reset(&mcts_tree, mine, theirs);
+	helpers_start_mcts();
+	for (i = 0; i % MCTS_CHECK_INTERVAL || now() < deadline; i++) {
+		mcts_iterate(&mcts_tree, &mcts_state);
+	}
+	helpers_stop();
+	stats.nodes += i;
+	stats.search += now() - search_start;
+
+	for (int c = 0; c < root->count; c++) {
+		child = &mcts_tree.nodes[root->first + c];
+		counts[child->move] = child->visits;
+		counts[64 + child->move] = child->score;
+	}
+	sync_start = now();
+	MPI_Reduce(counts, totals, 128, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (rank == 0) {
+		decision[0] = -1;
+		decision[1] = 0;
+		for (int sq = 0; sq < 64; sq++) {
+			playouts += totals[sq];
+			if (totals[sq] > best) {
+				best = totals[sq];
+				decision[0] = sq;
+				decision[1] = 50 * totals[64 + sq] / totals[sq];
+			}
+		}
+		log_info("MCTS %d playouts over all ranks, %d nodes on rank 0, in %f, move = %d, win rate %d%%\n",
+				playouts, mcts_tree.used < mcts_tree.capacity ? mcts_tree.used : mcts_tree.capacity,
+				MPI_Wtime() - wstart, decision[0], decision[1]);
+	}
+	MPI_Bcast(decision, 2, MPI_INT, 0, MPI_COMM_WORLD);
+	stats.sync += now() - sync_start;
+	stats.score = decision[1];
+	return decision[0];
 }
 
 void gather_moves_to_proc0(int *move, int *score, int level_colour) {
@@ -387,14 +1193,26 @@ void gather_moves_to_proc0(int *move, int *score, int level_colour) {
 
 }
 
-int run_level(int *move, int *score, int level_colour, int alpha, int beta) {
+/*
+	Searches every move of level_colour from the current board, spread over
+	all ranks, and leaves each rank's best move and score in move/score for
+	gather_moves_to_proc0().
+
+	Moves are handed out one at a time instead of being split up front, so
+	a rank that gets an easy subtree just asks for another move. Rank 0 is
+	the coordinator: workers send it a TAG_REQUEST with the score of the move
+	they just finished and get back a TAG_ASSIGN with the index of the next
+	move (-1 when there are none left) and the best score finished so far,
+	which tightens their window. Rank 0 searches moves too and answers
+	requests from inside minimax() while it does.
+ */
+int run_level(int *move, int *score, int level_colour, int alpha, int beta, int first) {
 
-    int *moves = (int *)malloc(LEGALMOVSBUFSIZE * sizeof(int));
-	int *local_moves;
-	int best_move_pos = -1;
-	int temp_board[BOARDSIZE];
-    memset(moves, 0, LEGALMOVSBUFSIZE);
-	copy_array(board, temp_board, BOARDSIZE);
+	int *moves = move_list(LEVEL_SLOT);
+	int request[2], assign[2];
+	int index, bound, a, b;
+	double sync_start;
+	struct Undo undo;
 	if (level_colour == my_colour) {
 		*score = SMALL;
 	} else {
@@ -403,91 +1221,461 @@ int run_level(int *move, int *score, int level_colour, int alpha, int beta) {
 
     legalmoves(level_colour, moves);
 
-	if (fp) {
-		fclose(fp);
+	// first goes to the front so rank 0 searches it
+	for (int i = 2; i < moves[0] + 1 && first != -1; i++) {
+		if (moves[i] == first) {
+			moves[i] = moves[1];
+			moves[1] = first;
+			break;
+		}
 	}
-	fp = fopen("output.txt", "a");
 
-//	if (rank == 0) {
-//		fprintf(fp, "Moves following:\n");
-//		for (int i = 1; i < moves[0] + 1; i++) {
-//			fprintf(fp, "%d ", moves[i]);
-//		}
-//		fprintf(fp, "\n");
-//	}
+	if (rank == 0) {
+		dispatch.moves = moves;
+		dispatch.next = 1;
+		dispatch.bound = level_colour == my_colour ? SMALL : BIG;
+		dispatch.level_colour = level_colour;
+		dispatch.finished = 0;
+		dispatch.polls = 0;
+		dispatch.active = size > 1;
+	}
+	request[0] = 0;
+	request[1] = 0;
 
-	local_n = moves[0]/size;
-	if (moves[0]%size != 0) {
-		for (int i = 0; i < moves[0] % size; i++) {
-			if (rank == i) {
-				local_n++;
-			}
+	while (1) {
+		if (rank == 0) {
+			index = dispatch_take();
+			bound = dispatch.bound;
+		} else {
+			// Waiting for rank 0 to hand out a move counts as sync time
+			sync_start = now();
+			MPI_Send(request, 2, MPI_INT, 0, TAG_REQUEST, MPI_COMM_WORLD);
+			MPI_Recv(assign, 2, MPI_INT, 0, TAG_ASSIGN, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+			stats.sync += now() - sync_start;
+			index = assign[0];
+			bound = assign[1];
+		}
+		if (index == -1) {
+			break;
 		}
-	}
-	local_moves = malloc(local_n * sizeof(int));
-	for (int i = 0; i < local_n; i++) {
-		for (int j = i*size; j < moves[0]; j++) {
-			if (j % size == rank) {
-				local_moves[i] = moves[j + 1];
-				break;
-			}
 
+		// One off the bound, like the phase 2 alpha, so ties are not cut off
+		a = alpha;
+		b = beta;
+		if (level_colour == my_colour && bound - 1 > a) {
+			a = bound - 1;
+		} else if (level_colour != my_colour && bound + 1 < b) {
+			b = bound + 1;
 		}
-	}
-	
-	for (int i = 0; i < local_n; i++) {
-		copy_array(temp_board, board, BOARDSIZE);
-		makemove(local_moves[i], level_colour);
+
+		undo = makemove(moves[index], level_colour);
 		start = MPI_Wtime();
-		minimax(DEPTH, opponent(level_colour), alpha, beta);
+		if (solving) {
+			mm_score = solve_position(a, b);
+		} else {
+			mm_score = search_root_move(level_colour, a, b, index == 1);
+		}
 		finish = MPI_Wtime();
+		stats.search += finish - start;
+		unmakemove(undo);
 		if (DEBUG == 1) {
-	//		fprintf(fp, "P%d: Time taken for that minimax = %f\n", rank, finish - start);
-			fprintf(fp, "Proc %d move = %d, mm_score = %d\n", rank, local_moves[i], mm_score);
-	//		fprintf(fp, "Proc %d DEPTH = %d\n", rank, DEPTH);
-		}
-		if (finish - start >= TIME/local_n) {
-			change_depth = -1;
-		} else if (finish - start <= 3/local_n) {
-			change_depth = 1;
+			log_debug("Proc %d move = %d, mm_score = %d, time = %f\n",
+					rank, moves[index], mm_score, finish - start);
 		}
 		if (level_colour == my_colour) {
 			if (mm_score > *score) {
 				*score = mm_score;
-				*move = local_moves[i];
+				*move = moves[index];
 			}
 		} else {
 			if (mm_score < *score) {
 				*score = mm_score;
-				*move = local_moves[i];
+				*move = moves[index];
+			}
+		}
+		if (rank == 0) {
+			dispatch_result(mm_score);
+		} else {
+			request[0] = 1;
+			request[1] = mm_score;
+		}
+	}
+
+	if (rank == 0) {
+		// So does waiting for the workers to finish their last moves
+		sync_start = now();
+		while (dispatch.finished < size - 1) {
+			if (pondering) {
+				// Waiting on a worker must not stop us hearing the server
+				struct timespec nap = {0, IDLE_NAP_NS};
+				serve_requests(0);
+				check_server();
+				nanosleep(&nap, NULL);
+			} else {
+				serve_requests(1);
+			}
+		}
+		stats.sync += now() - sync_start;
+		dispatch.active = 0;
+	}
+	return 0;
+}
+
+/*
+	Searches the root move already played on the board. Apart from the
+	first move of the level, a move is only searched with the full window
+	once a zero-window probe against the best score so far says it might
+	beat it. Before there is a score to beat every move needs the full
+	window anyway.
+ */
+int search_root_move(int level_colour, int alpha, int beta, int full) {
+	int score;
+
+	if (!full && level_colour == my_colour && alpha > SMALL) {
+		score = helped_minimax(opponent(level_colour), alpha, alpha + 1);
+		if (score <= alpha || score >= beta || timed_out) {
+			return score;
+		}
+	} else if (!full && level_colour != my_colour && beta < BIG) {
+		score = helped_minimax(opponent(level_colour), beta - 1, beta);
+		if (score >= beta || score <= alpha || timed_out) {
+			return score;
+		}
+	}
+	return helped_minimax(opponent(level_colour), alpha, beta);
+}
+
+/* minimax() at DEPTH with the helper threads searching alongside */
+int helped_minimax(int level_colour, int alpha, int beta) {
+	int score;
+
+	helpers_start(DEPTH, level_colour, alpha, beta);
+	score = minimax(DEPTH, level_colour, alpha, beta);
+	helpers_stop();
+	return score;
+}
+
+/* Index of the next root move nobody has searched yet, -1 if none */
+int dispatch_take() {
+	if (dispatch.next > dispatch.moves[0]) {
+		return -1;
+	}
+	return dispatch.next++;
+}
+
+void dispatch_result(int score) {
+	if (dispatch.level_colour == my_colour) {
+		if (score > dispatch.bound) {
+			dispatch.bound = score;
+		}
+	} else {
+		if (score < dispatch.bound) {
+			dispatch.bound = score;
+		}
+	}
+}
+
+/*
+	Rank 0 answers work requests. With block set it waits for exactly one
+	request, otherwise it answers whatever has already arrived and returns.
+ */
+void serve_requests(int block) {
+	int request[2], assign[2], flag;
+	MPI_Status status;
+
+	while (1) {
+		if (!block) {
+			MPI_Iprobe(MPI_ANY_SOURCE, TAG_REQUEST, MPI_COMM_WORLD, &flag, &status);
+			if (!flag) {
+				return;
 			}
 		}
-		copy_array(temp_board, board, BOARDSIZE);
+		MPI_Recv(request, 2, MPI_INT, MPI_ANY_SOURCE, TAG_REQUEST, MPI_COMM_WORLD, &status);
+		if (request[0]) {
+			dispatch_result(request[1]);
+		}
+		assign[0] = dispatch_take();
+		assign[1] = dispatch.bound;
+		if (assign[0] == -1) {
+			dispatch.finished++;
+		}
+		MPI_Send(assign, 2, MPI_INT, status.MPI_SOURCE, TAG_ASSIGN, MPI_COMM_WORLD);
+		if (block) {
+			return;
+		}
+	}
+}
+
+
+/*
+	Rank 0 tells every worker what to do next. Commands are small enough
+	to go out eagerly, so this never waits for a busy worker.
+ */
+void send_command(int type) {
+	struct Command command;
+
+	command.type = type;
+	command.colour = my_colour;
+	command.board = board;
+	command.budget = budget;
+	for (int r = 1; r < size; r++) {
+		MPI_Send(&command, sizeof(command), MPI_BYTE, r, TAG_COMMAND, MPI_COMM_WORLD);
+	}
+}
+
+/*
+	Waits for the next command from rank 0. A plain MPI_Recv would spin a
+	core for as long as the opponent thinks, so after a short burst of
+	checks (a search usually follows closely on the last one) the worker
+	naps between checks instead.
+ */
+void receive_command(struct Command *command) {
+	struct timespec nap = {0, IDLE_NAP_NS};
+	MPI_Request request;
+	int done = 0;
+
+	if (has_pending) {
+		*command = pending;
+		has_pending = 0;
+		return;
+	}
+	MPI_Irecv(command, sizeof(*command), MPI_BYTE, 0, TAG_COMMAND, MPI_COMM_WORLD, &request);
+	for (int checks = 0; ; checks++) {
+		MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+		if (done) {
+			break;
+		}
+		if (checks >= IDLE_SPINS) {
+			nanosleep(&nap, NULL);
+		}
+	}
+}
+
+/*
+	Checked by a worker's search now and then: 1 if rank 0 has sent a stop.
+	Anything else that turns up is kept for receive_command().
+ */
+int stop_requested() {
+	struct Command command;
+	int flag;
+
+	if (rank == 0 || helper || has_pending) {
+		return 0;
+	}
+	MPI_Iprobe(0, TAG_COMMAND, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
+	if (!flag) {
+		return 0;
+	}
+	MPI_Recv(&command, sizeof(command), MPI_BYTE, 0, TAG_COMMAND, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	if (command.type == CMD_STOP) {
+		return 1;
+	}
+	pending = command;
+	has_pending = 1;
+	return 0;
+}
+
+/* What the workers do between searches */
+void worker_loop() {
+	struct Command command;
+
+	while (1) {
+		receive_command(&command);
+		if (command.type == CMD_SHUTDOWN) {
+			break;
+		}
+		my_colour = command.colour;
+		board = command.board;
+		budget = command.budget;
+		hash_key = zobrist_hash(&board);
+		reset_evaluation();
+		if (command.type == CMD_SEARCH) {
+			report_stats(run_worker());
+		} else if (command.type == CMD_PONDER) {
+			run_ponder();
+		}
+		// A stop that arrives after the search ended has nothing to stop
+	}
+}
+
+/*
+	OTHELLO_PONDER=0 turns pondering off. Pondering is only fair if the
+	opponent runs on cores of its own; on shared cores it takes CPU away
+	from the opponent's turn, so turn it off there.
+ */
+void initialise_ponder(){
+	char *env = getenv("OTHELLO_PONDER");
+
+	if (env) {
+		ponder_enabled = atoi(env);
+	}
+}
+
+/*
+	Runs on every rank after our move, while the opponent thinks. It is an
+	iterative deepening search of the opponent's replies, handed out like
+	any other level, and it does nothing useful with its result except to
+	leave the transposition tables full of the positions we are about to
+	be asked about. Rank 0 stops it when the server sends anything.
+
+	Close to the end there is no point: the solver does not use the table,
+	and neither does MCTS.
+ */
+void run_ponder(){
+	int move, score, depth, empties, any_timed_out;
+	uint64_t replies = board.colour == my_colour
+		? get_moves(board.opponent, board.player)
+		: get_moves(board.player, board.opponent);
+
+	empties = 64 - popcount(board.player | board.opponent);
+	if (!ponder_enabled || mcts_enabled || !replies || empties - 1 <= endgame_empties) {
+		return;
+	}
+
+	pondering = 1;
+	ponder_stopped = 0;
+	deadline = now() + PONDER_TIME_LIMIT;
+	wstart = MPI_Wtime();
+
+	for (depth = 1; depth < empties && depth <= MAX_DEPTH; depth++) {
+		timed_out = 0;
+		DEPTH = depth - 1;
+		DEBUG = 0;
+		move = -1;
+
+		run_level(&move, &score, opponent(my_colour), SMALL, BIG, tt_best_move());
+		MPI_Barrier(MPI_COMM_WORLD);
+		gather_moves_to_proc0(&move, &score, opponent(my_colour));
+		MPI_Allreduce(&timed_out, &any_timed_out, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+		if (any_timed_out) {
+			break;
+		}
+		if (rank == 0) {
+			ponder_move = move;
+			log_info("Ponder depth %d done in %f, expecting %d, score = %d\n",
+					depth, MPI_Wtime() - wstart, move, score);
+		}
+	}
+	pondering = 0;
+	timed_out = 0;
+}
+
+/* Rank 0 while pondering: stop every rank as soon as the server speaks */
+void check_server(){
+	struct pollfd server = {server_socket, POLLIN, 0};
+
+	if (!ponder_stopped && server_socket != -1 && poll(&server, 1, 0) > 0) {
+		ponder_stopped = 1;
+		send_command(CMD_STOP);
+	}
+	if (ponder_stopped) {
+		timed_out = 1;
+	}
+}
+
+/*
+	Rank 0 writes one JSON line per searched move to OTHELLO_STATS
+	(stats.jsonl by default, an empty name turns it off) so games can be
+	compared after the fact. The other ranks only send their counters.
+ */
+void initialise_stats(){
+	char *path = getenv("OTHELLO_STATS");
+
+	if (rank != 0) {
+		return;
+	}
+	if (!path) {
+		path = STATS_DEFAULT_PATH;
 	}
-	free(moves);
-	free(local_moves);
+	if (path[0]) {
+		stats_file = fopen(path, "w");
+	}
+}
 
+/* Clears this rank's counters, helpers included, before a move */
+void reset_stats(){
+	memset(&stats, 0, sizeof(stats));
+	pthread_mutex_lock(&pool.lock);
+	memset(&pool.stats, 0, sizeof(pool.stats));
+	pthread_mutex_unlock(&pool.lock);
 }
 
+/* Adds the counters and search times of from to to */
+void add_stats(struct SearchStats *to, const struct SearchStats *from){
+	to->nodes += from->nodes;
+	to->expanded += from->expanded;
+	to->cutoffs += from->cutoffs;
+	to->first_cutoffs += from->first_cutoffs;
+	to->probcuts += from->probcuts;
+	to->tt_probes += from->tt_probes;
+	to->tt_hits += from->tt_hits;
+	to->search += from->search;
+	to->sync += from->sync;
+}
+
+/*
+	Called by every rank after run_worker() returns move. Rank 0 gathers
+	everyone's counters and writes the move's line: the totals over all
+	ranks and then each rank on its own.
+ */
+void report_stats(int move){
+	struct SearchStats all[size], sum;
+
+	add_stats(&stats, &pool.stats);
+	MPI_Gather(&stats, sizeof(stats), MPI_BYTE, all, sizeof(stats), MPI_BYTE, 0, MPI_COMM_WORLD);
+	if (rank != 0 || !stats_file) {
+		return;
+	}
+
+	sum = stats;
+	for (int r = 1; r < size; r++) {
+		add_stats(&sum, &all[r]);
+	}
+	fprintf(stats_file, "{\"empties\":%d,\"colour\":%d,\"move\":%d,\"score\":%d,"
+			"\"depth\":%d,\"solved\":%s,\"ranks\":%d,",
+			64 - popcount(board.player | board.opponent), my_colour, move, stats.score,
+			stats.depth, stats.solved ? "true" : "false", size);
+	write_stats(stats_file, &sum);
+	fprintf(stats_file, ",\"per_rank\":[");
+	for (int r = 0; r < size; r++) {
+		fprintf(stats_file, "%s{\"rank\":%d,", r ? "," : "", r);
+		write_stats(stats_file, &all[r]);
+		fprintf(stats_file, "}");
+	}
+	fprintf(stats_file, "]}\n");
+	fflush(stats_file);
+}
+
+/* The fields shared by the totals and the per rank entries */
+void write_stats(FILE *out, const struct SearchStats *s){
+	fprintf(out, "\"time\":%.3f,\"nodes\":%ld,\"nps\":%.0f,\"cutoff_rate\":%.3f,"
+			"\"first_cutoff\":%.3f,\"probcuts\":%ld,\"tt_hit_rate\":%.3f,\"search_time\":%.3f,\"sync_time\":%.3f",
+			s->total, s->nodes, ratio(s->nodes, s->total), ratio(s->cutoffs, s->expanded),
+			ratio(s->first_cutoffs, s->cutoffs), s->probcuts, ratio(s->tt_hits, s->tt_probes),
+			s->search, s->sync);
+}
+
+double ratio(double a, double b){
+	return b > 0 ? a / b : 0;
+}
 
 int best_moves_index(int *moves, int colour) {
 
 	int index = -1;
 	int max = SMALL;
-	int temp[BOARDSIZE];
+	struct Undo undo;
 	int eval;
-	copy_array(board, temp, BOARDSIZE);
 
 	for (int i = 1; i < moves[0] + 1; i++) {
-		copy_array(temp, board, BOARDSIZE);
-		makemove(moves[i], colour);
+		undo = makemove(moves[i], colour);
 		eval = evaluate();
+		unmakemove(undo);
 		if (eval > max) {
 			max = eval;
 			index = i;
 		}
 	}
-	copy_array(temp, board, BOARDSIZE);
 	return index;
 }
 
@@ -503,29 +1691,34 @@ int best_moves_index(int *moves, int colour) {
 	before returning.
  */
 void gen_move(char *move){
+    uint64_t moves;
     int loc;
     if (my_colour == EMPTY){
         my_colour = BLACK;
     }
-	
-	enter = 1;
-	MPI_Bcast(&enter, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-    loc = run_worker();
-
-	enter = 0;
-	MPI_Bcast(&enter, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	// Book positions and forced moves are answered straight away, the
+	// workers stay asleep
+	moves = my_moves();
+	if (popcount(moves) <= 1) {
+		loc = moves ? first_square(moves) : -1;
+	} else {
+		loc = book_move();
+	}
+	if (loc == -1 && moves) {
+		budget = plan_move(64 - popcount(board.player | board.opponent), popcount(moves));
+		send_command(CMD_SEARCH);
+		loc = run_worker();
+		report_stats(loc);
+	}
 
-	fclose(fp);
-	fp = fopen("output.txt", "a");
     if (loc == -1){
         strncpy(move, "pass\n", MOVEBUFSIZE);
     } else {
-		fprintf(fp, "loc = %d\n", loc);
-		fclose(fp);
-		fp = fopen("output.txt", "a");
+		log_info("loc = %d\n", loc);
         get_move_string(loc, move);
         makemove(loc, my_colour);
+        send_command(CMD_POSITION);
     }
 }
 
@@ -545,19 +1738,30 @@ void play_move(char *move){
 
     loc = get_loc(move);
 
+    if (ponder_move != -1) {
+        log_info("Ponder %s, expected %d got %d\n",
+                loc == ponder_move ? "hit" : "miss", ponder_move, loc);
+        ponder_move = -1;
+    }
     makemove(loc, opponent(my_colour));
+    send_command(CMD_POSITION);
 }
 
 void game_over(){
+    free_threads();
+    free_book();
     free_board();
+    if (stats_file) {
+        fclose(stats_file);
+    }
+    log_close();
     MPI_Finalize();
 }
 
 void get_move_string(int loc, char *ms){
-    int row, col, new_loc;
-    new_loc = loc - (9 + 2 * (loc / 10));
-    row = new_loc / 8;
-    col = new_loc % 8;
+    int row, col;
+    row = loc / 8;
+    col = loc % 8;
     ms[0] = row + '0';
     ms[1] = col + '0';
     ms[2] = '\n';
@@ -568,50 +1772,24 @@ int get_loc(char* movestring){
     int row, col;
     row = movestring[0] - '0';
     col = movestring[1] - '0';
-    return (10 * (row + 1)) + col + 1;
+    return SQUARE(row, col);
 }
 
 void legalmoves (int player, int *moves) {
-    int move, i;
-    moves[0] = 0;
-    i = 0;
-    for (move=11; move<=88; move++)
-        if (legalp(move, player)) {
-            i++;
-            moves[i]=move;
-        }
-    moves[0]=i;
-}
-
-int legalp (int move, int player) {
-    int i;
-    if (!validp(move)) return 0;
-    if (board[move]==EMPTY) {
-        i=0;
-        while (i<=7 && !wouldflip(move, ALLDIRECTIONS[i], player)) i++;
-        if (i==8) return 0; else return 1;
+    uint64_t P, O, legal;
+    int i = 0;
+    if (board.colour == player) {
+        P = board.player; O = board.opponent;
+    } else {
+        P = board.opponent; O = board.player;
     }
-    else return 0;
-}
-
-int validp (int move) {
-    if ((move >= 11) && (move <= 88) && (move%10 >= 1) && (move%10 <= 8))
-        return 1;
-    else return 0;
-}
-
-int wouldflip (int move, int dir, int player) {
-    int c;
-    c = move + dir;
-    if (board[c] == opponent(player))
-        return findbracketingpiece(c+dir, dir, player);
-    else return 0;
-}
-
-int findbracketingpiece(int square, int dir, int player) {
-    while (board[square] == opponent(player)) square = square + dir;
-    if (board[square] == player) return square;
-    else return 0;
+    legal = get_moves(P, O);
+    while (legal) {
+        i++;
+        moves[i] = first_square(legal);
+        legal &= legal - 1;
+    }
+    moves[0] = i;
 }
 
 int opponent (int player) {
@@ -622,217 +1800,482 @@ int opponent (int player) {
     }
 }
 
-void copy_array(int *source, int *dest, int length) {
-	for (int i = 0; i < length; i++) {
-		dest[i] = source[i];
-	}
-}
 // ************************************************************
 // This is the minimax strategy -------------------------------
 // ************************************************************
+
+/*
+	Score of board from my_colour's point of view, as the root code wants
+	it. level_colour has to be the side to move in board, which it always
+	is once the root move has been made. The search itself is negamax().
+ */
 int minimax(int depth, int level_colour, int alpha, int beta) {
+	if (level_colour == my_colour) {
+		return negamax(depth, alpha, beta);
+	}
+	return -negamax(depth, -beta, -alpha);
+}
 
-	int *moves = (int *)malloc(LEGALMOVSBUFSIZE * sizeof(int));
-	memset(moves, 0, LEGALMOVSBUFSIZE);
-	legalmoves(my_colour, moves);
+/*
+	Alpha-beta for the side to move in board, scores from its own point of
+	view. Whose turn it is lives in the board (player is always the side to
+	move), so there is no max and min half and no colour test per move; the
+	transposition table is kept the same way.
+ */
+int negamax(int depth, int alpha, int beta) {
+
+	int tt_move = -1;
+	int tt_score;
+	int alpha_orig = alpha;
+	int *moves;
+	int n = 0, best = SMALL, move = -1, result;
+	struct Undo undo;
+
+	stats.nodes++;
+	if (depth == 0) {
+		return pattern_state_evaluate(&eval_state, board.colour);
+	}
 
-	if (depth > 0 && moves[0] != 0) {
-
-		int temp_board[BOARDSIZE]; 
-
-		copy_array(board, temp_board, BOARDSIZE);
-
-		int max = SMALL;
-		int min = BIG;
-		int move = -1;
-		graph_size += moves[0];
-
-		for (int i = 1; i < moves[0] + 1; i++) {
-			copy_array(temp_board, board, BOARDSIZE);
-
-			makemove(moves[i], level_colour);
-
-			int result = minimax(depth-1, opponent(level_colour), alpha, beta);
-
-			if (level_colour == my_colour) {
-				if (result > max) {
-					max = result;
-					if (depth == DEPTH) {
-						mm_score = max;
-					}
-					move = moves[i];
-					if (max > alpha) {
-						alpha = max;
-					}
-					if (beta <= alpha && ABP) {
-						copy_array(temp_board, board, BOARDSIZE);
-						free(moves);
-						if (depth != DEPTH) {
-							return max;
-						} else {
-							return move;
-						}
-					}
-				}
-			} else {
-				if (result < min) {
-					min = result;
-					if (depth == DEPTH) {
-						mm_score = min;
-					}
-					move = moves[i];
-					if (min < beta) {
-						beta = min;
-					}
-					if (beta <= alpha && ABP) {
-						copy_array(temp_board, board, BOARDSIZE);
-						free(moves);
-						if (depth != DEPTH) {
-							return min;
-						} else {
-							return move;
-						}
-					}
-				}
-			}
-			if (MPI_Wtime() - start >= TIME/local_n) {
-				free(moves);
-				copy_array(temp_board, board, BOARDSIZE);
-				if (level_colour == my_colour) {
-					if (depth == DEPTH) {
-						return move;
-					}
-					return max;
-				} else {
-					if (depth == DEPTH) {
-						return move;
-					}
-					return min;
-				}
+	if (tt_probe(depth, alpha, beta, &tt_score, &tt_move)) {
+		return tt_score;
+	}
+	if (depth == 1) {
+		return frontier();
+	}
+	if (PROBCUT_CONFIDENCE > 0 && !probing && depth >= PROBCUT_MIN_DEPTH) {
+		result = probcut(depth, alpha, beta);
+		if (result != 0) {
+			return result > 0 ? beta : alpha;
+		}
+	}
+
+	moves = move_list(depth);
+	for (uint64_t legal = get_moves(board.player, board.opponent); legal; legal &= legal - 1) {
+		moves[++n] = first_square(legal);
+	}
+	moves[0] = n;
+	if (n == 0) {
+		return pattern_state_evaluate(&eval_state, board.colour);
+	}
+	stats.expanded++;
+
+	order_moves(moves, depth, tt_move);
+
+	for (int i = 1; i < n + 1; i++) {
+		undo = play(moves[i]);
+
+		// Principal variation search: the first move gets the full
+		// window, the rest only have to show they can't beat it
+		if (i == 1) {
+			result = -negamax(depth - 1, -beta, -alpha);
+		} else {
+			result = -negamax(depth - 1, -alpha - 1, -alpha);
+			if (result > alpha && result < beta && !timed_out) {
+				result = -negamax(depth - 1, -beta, -alpha);
 			}
 		}
-		copy_array(temp_board, board, BOARDSIZE);
-		free(moves);
-		if (level_colour == my_colour) {
-			if (depth == DEPTH) {
-				return move;
+
+		unmakemove(undo);
+
+		if (dispatch.active && !helper && ++dispatch.polls % POLL_INTERVAL == 0) {
+			serve_requests(0);
+		} else if (rank != 0 && !helper && ++stop_polls % POLL_INTERVAL == 0 && stop_requested()) {
+			timed_out = 1;
+		}
+		if (pondering && rank == 0 && !helper && ++stop_polls % POLL_INTERVAL == 0) {
+			check_server();
+		}
+
+		if (result > best) {
+			best = result;
+			move = moves[i];
+			if (best > alpha) {
+				alpha = best;
 			}
-			return max;
-		} else {
-			if (depth == DEPTH) {
-				return move;
+			if (alpha >= beta && ABP) {
+				stats.cutoffs++;
+				stats.first_cutoffs += i == 1;
+				remember_cutoff(depth, move);
+				if (!timed_out) {
+					tt_store(depth, TT_LOWER, best, move);
+				}
+				return best;
 			}
-			return min;
 		}
+		if (timed_out || now() >= deadline || (helper && pool.stop)) {
+			// Partial results must not end up in the table
+			timed_out = 1;
+			return best;
+		}
+	}
+	tt_store(depth, best <= alpha_orig ? TT_UPPER : TT_EXACT, best, move);
+	return best;
+}
 
+/*
+	Multi-ProbCut. A shallow search predicts the result of the full one
+	(probcut.h has the fit for each depth and stage of the game), so if
+	even the prediction less PROBCUT_CONFIDENCE standard errors beats beta
+	the node almost surely fails high, and likewise low against alpha.
+	Each test is a zero-window search at the bound the shallow score would
+	have to reach. Returns 1 for a cut high, -1 for low and 0 if the node
+	has to be searched.
+
+	Beyond the depths in the table the deepest fit stands in, with the
+	shallow search kept the same distance below.
+ */
+int probcut(int depth, int alpha, int beta) {
+	const struct ProbCut *fit;
+	int stage = (eval_state.discs - 4) >> 4;
+	int shallow, bound, score, cut = 0;
+	double margin;
+
+	if (depth > PROBCUT_MAX_DEPTH) {
+		fit = &probcut_table[stage][PROBCUT_MAX_DEPTH];
+		shallow = depth - (PROBCUT_MAX_DEPTH - fit->shallow);
 	} else {
-		free(moves);
-		return evaluate();
+		fit = &probcut_table[stage][depth];
+		shallow = fit->shallow;
+	}
+	if (fit->sigma <= 0 || fit->a <= 0 || shallow < 1) {
+		return 0;
+	}
+	margin = PROBCUT_CONFIDENCE * fit->sigma;
+
+	probing = 1;
+	bound = (int)ceil((beta + margin - fit->b) / fit->a);
+	if (beta < BIG && bound < BIG) {
+		score = negamax(shallow, bound - 1, bound);
+		if (score >= bound && !timed_out) {
+			cut = 1;
+		}
+	}
+	bound = (int)floor((alpha - margin - fit->b) / fit->a);
+	if (!cut && alpha > SMALL && bound > SMALL) {
+		score = negamax(shallow, bound, bound + 1);
+		if (score <= bound && !timed_out) {
+			cut = -1;
+		}
 	}
+	probing = 0;
+	stats.probcuts += cut != 0;
+	return cut;
 }
 
-int evaluate() {
-//		Evaluation
-	int me, opp;
-	int score = 0;
-	
-	if (board[33] == my_colour) {
-		score+=1;
-	}
-	if (board[34] == my_colour) {
-		score+=1;
-	}
-	if (board[43] == my_colour) {
-		score+=1;
-	}
-	if (board[44] == my_colour) {
-		score+=1;
-	}
-	for (int i = 11; i < 88; i++) {
-		if (i%10 == 1 || i%10 == 8) {
-			if (board[i] == my_colour) {
-				score += 5;
-			} else if (board[i] == opponent(my_colour)) {
-				score -= 5;
-			}
+/*
+	OTHELLO_PROBCUT sets PROBCUT_CONFIDENCE: higher prunes less, and 0
+	turns ProbCut off so every node is searched in full.
+ */
+void initialise_probcut(){
+	char *env = getenv("OTHELLO_PROBCUT");
+
+	if (env) {
+		PROBCUT_CONFIDENCE = atof(env);
+	}
+}
+
+/*
+	OTHELLO_SEARCH=mcts plays with Monte Carlo tree search instead of
+	minimax, up to the endgame solver. OTHELLO_MCTS_NODES sets the size of
+	each rank's node pool; once it is full the tree stops growing and the
+	leaves just get more playouts.
+ */
+void initialise_mcts(){
+	char *env = getenv("OTHELLO_SEARCH");
+
+	if (!env || strcmp(env, "mcts") != 0) {
+		return;
+	}
+	mcts_tree.capacity = MCTS_DEFAULT_NODES;
+	env = getenv("OTHELLO_MCTS_NODES");
+	if (env && atoi(env) > 1) {
+		mcts_tree.capacity = atoi(env);
+	}
+	mcts_tree.nodes = (struct MctsNode *)malloc(mcts_tree.capacity * sizeof(struct MctsNode));
+	mcts_enabled = mcts_tree.nodes != NULL;
+	mcts_state = 0x9E3779B97F4A7C15ULL * (uint64_t)(rank * MAX_THREADS + 1);
+}
+
+/*
+	Sorts the move list best first: the move the table remembers, then the
+	killers of this depth (moves that recently cut off a sibling), then by
+	history, which counts how often and how deep each square has cut off
+	for the side to move.
+ */
+void order_moves(int *moves, int depth, int tt_move) {
+	int order[LEGALMOVSBUFSIZE];
+	int move, key, j;
+
+	for (int i = 1; i < moves[0] + 1; i++) {
+		move = moves[i];
+		if (move == tt_move) {
+			key = TT_MOVE_ORDER;
+		} else if (move == killers[depth][0]) {
+			key = KILLER_ORDER + 1;
+		} else if (move == killers[depth][1]) {
+			key = KILLER_ORDER;
+		} else {
+			key = history[board.colour][move] < KILLER_ORDER
+				? (int)history[board.colour][move] : KILLER_ORDER - 1;
+		}
+		for (j = i; j > 1 && order[j - 1] < key; j--) {
+			moves[j] = moves[j - 1];
+			order[j] = order[j - 1];
 		}
+		moves[j] = move;
+		order[j] = key;
 	}
-	for (int i = 11; i < 88; i++) {
-		if (i%10 < 18 || i > 81) {
-			if (board[i] == my_colour) {
-				score += 5;
-			} else if (board[i] == opponent(my_colour)) {
-				score -= 5;
-			}
+}
+
+/* move just cut off for the side to move at depth */
+void remember_cutoff(int depth, int move) {
+	if (killers[depth][0] != move) {
+		killers[depth][1] = killers[depth][0];
+		killers[depth][0] = move;
+	}
+	// Racy between threads, but a lost update only costs a little ordering
+	history[board.colour][move] += depth * depth;
+}
+
+/* Killers are per thread; -1 is no move */
+void clear_killers() {
+	for (int d = 0; d < MAX_DEPTH + 1; d++) {
+		for (int k = 0; k < KILLERS; k++) {
+			killers[d][k] = -1;
+		}
+	}
+}
+
+/*
+	Halves the history before every move so it follows the position
+	instead of the whole game, and keeps it well away from KILLER_ORDER.
+ */
+void age_history() {
+	for (int c = 0; c < 3; c++) {
+		for (int sq = 0; sq < 64; sq++) {
+			history[c][sq] >>= 1;
+		}
+	}
+}
+
+/*
+	negamax() one ply above the leaves. Every child is a leaf, so instead
+	of playing each move on the board and searching it, the flips of all
+	the moves are worked out together (see get_flips_batch()) and each
+	child is scored from its own copy of the pattern indices; the board
+	and the hash are never touched. With nothing below to cut off, the
+	exact best score costs no more than a bound, so there is no window.
+ */
+int frontier() {
+	uint64_t moves, f;
+	uint64_t flips[64];
+	int squares[64];
+	int n = 0, best = SMALL, move = -1, score;
+	struct PatternState child;
+
+	moves = get_moves(board.player, board.opponent);
+	if (!moves) {
+		return pattern_state_evaluate(&eval_state, board.colour);
+	}
+	for (; moves; moves &= moves - 1) {
+		squares[n++] = first_square(moves);
+	}
+	get_flips_batch(squares, n, board.player, board.opponent, flips);
+
+	for (int i = 0; i < n; i++) {
+		child = eval_state;
+		pattern_place(&child, board.colour, squares[i]);
+		for (f = flips[i]; f; f &= f - 1) {
+			pattern_flip(&child, board.colour, first_square(f));
+		}
+		// The child's score for the side that just moved, i.e. ours
+		score = pattern_state_evaluate(&child, board.colour);
+		if (score > best) {
+			best = score;
+			move = squares[i];
 		}
 	}
-	if (board[11] == my_colour) {
-		score += 30;
-	} else if (board[11] == opponent(my_colour)) {
-		score -= 30;
+	stats.nodes += n;
+	stats.expanded++;
+	tt_store(1, TT_EXACT, best, move);
+	return best;
+}
+
+// ************************************************************
+// Exact endgame solver ---------------------------------------
+// ************************************************************
+
+/*
+	Exact final disc differential of board from my_colour's point of view,
+	within the window alpha, beta (fail-soft outside it).
+ */
+int solve_position(int alpha, int beta) {
+	int empties = 64 - popcount(board.player | board.opponent);
+
+	if (board.colour == my_colour) {
+		return solve(board.player, board.opponent, alpha, beta, empties);
 	}
-	if (board[18] == my_colour) {
-		score += 30;
-	} else if (board[18] == opponent(my_colour)) {
-		score -= 30;
+	return -solve(board.player, board.opponent, -beta, -alpha, empties);
+}
+
+/*
+	Negamax alpha-beta to the end of the game for P to move against O,
+	scoring only the final disc differential, so no evaluate() and no
+	board globals. Above FASTEST_FIRST_EMPTIES the moves that leave the
+	opponent the fewest replies are tried first; below it ordering costs
+	more than it saves and the moves are taken as they come, down to
+	solve_last() for the final square.
+ */
+int solve(uint64_t P, uint64_t O, int alpha, int beta, int empties) {
+	uint64_t moves, flips, x;
+	uint64_t move_flips[64];
+	int squares[64], mobility[64];
+	int n = 0, best = SMALL, score, sq;
+
+	if (timed_out) {
+		return alpha;
 	}
-	if (board[81] == my_colour) {
-		score += 30;
-	} else if (board[81] == opponent(my_colour)) {
-		score -= 30;
+	if (++stats.nodes % SOLVE_CHECK_INTERVAL == 0) {
+		// Rank 0 hands out the other root moves while it solves its own
+		if (dispatch.active && !helper) {
+			serve_requests(0);
+		}
+		if (now() >= deadline || stop_requested()) {
+			timed_out = 1;
+			return alpha;
+		}
 	}
-	if (board[88] == my_colour) {
-		score += 30;
-	} else if (board[88] == opponent(my_colour)) {
-		score -= 30;
+	if (empties == 0) {
+		return game_score(P, O);
 	}
-	if (board[22] == my_colour && board[33] == opponent(my_colour)) {
-		score -= 30;
+	if (empties == 1) {
+		return solve_last(P, O, first_square(~(P | O)));
 	}
-	if (board[27] == my_colour && board[36] == opponent(my_colour)) {
-		score -= 30;
+
+	moves = get_moves(P, O);
+	if (!moves) {
+		if (!get_moves(O, P)) {
+			return game_score(P, O);
+		}
+		return -solve(O, P, -beta, -alpha, empties);
 	}
-	if (board[72] == my_colour && board[63] == opponent(my_colour)) {
-		score -= 30;
+
+	if (empties <= FASTEST_FIRST_EMPTIES) {
+		for (; moves; moves &= moves - 1) {
+			sq = first_square(moves);
+			x = BIT(sq);
+			flips = get_flips(sq, P, O);
+			score = -solve(O & ~flips, P | flips | x, -beta, -alpha, empties - 1);
+			if (score > best) {
+				best = score;
+				if (best > alpha) {
+					alpha = best;
+				}
+				if (alpha >= beta) {
+					break;
+				}
+			}
+		}
+		return best;
 	}
-	if (board[77] == my_colour && board[66] == opponent(my_colour)) {
-		score -= 30;
+
+	// Fastest first: insertion sort on the opponent's mobility
+	for (; moves; moves &= moves - 1) {
+		int i;
+		sq = first_square(moves);
+		flips = get_flips(sq, P, O);
+		score = popcount(get_moves(O & ~flips, P | flips | BIT(sq)));
+		for (i = n; i > 0 && mobility[i - 1] > score; i--) {
+			squares[i] = squares[i - 1];
+			move_flips[i] = move_flips[i - 1];
+			mobility[i] = mobility[i - 1];
+		}
+		squares[i] = sq;
+		move_flips[i] = flips;
+		mobility[i] = score;
+		n++;
 	}
-	for (int i = 0; i < 89; i++) {
-		if (i%11 == 0 || i%9 == 0) {
-			if (board[i] == opponent(my_colour)) {
-				score -= 6;
-			}	
+	for (int i = 0; i < n; i++) {
+		x = BIT(squares[i]);
+		flips = move_flips[i];
+		score = -solve(O & ~flips, P | flips | x, -beta, -alpha, empties - 1);
+		if (score > best) {
+			best = score;
+			if (best > alpha) {
+				alpha = best;
+			}
+			if (alpha >= beta) {
+				break;
+			}
 		}
 	}
-	me = count(my_colour, board);
-	opp = count(opponent(my_colour), board);
-	score = score + me*3 - opp*3;
-	return score;
+	return best;
+}
+
+/* Final score with one empty square sq left and P to move */
+int solve_last(uint64_t P, uint64_t O, int sq) {
+	int diff = popcount(P) - popcount(O);
+	int flipped = popcount(get_flips(sq, P, O));
+
+	if (flipped) {
+		return diff + 2 * flipped + 1;
+	}
+	flipped = popcount(get_flips(sq, O, P));
+	if (flipped) {
+		return diff - 2 * flipped - 1;
+	}
+	// Nobody can play it, the empty square goes to the winner
+	if (diff > 0) {
+		return diff + 1;
+	} else if (diff < 0) {
+		return diff - 1;
+	}
+	return 0;
+}
+
+/* Disc differential of a finished game, empty squares go to the winner */
+int game_score(uint64_t P, uint64_t O) {
+	int diff = popcount(P) - popcount(O);
+	int empties = 64 - popcount(P | O);
+
+	if (diff > 0) {
+		return diff + empties;
+	} else if (diff < 0) {
+		return diff - empties;
+	}
+	return 0;
+}
+
+/*
+	Static evaluation from my_colour's point of view, see pattern.h
+ */
+int evaluate() {
+	return pattern_state_evaluate(&eval_state, my_colour);
+}
+
+/* Rebuilds eval_state after board has been set some other way than makemove() */
+void reset_evaluation() {
+	if (board.colour == BLACK) {
+		pattern_state_init(&eval_state, board.player, board.opponent);
+	} else {
+		pattern_state_init(&eval_state, board.opponent, board.player);
+	}
 }
 
 
 int potential_move_score(int move, int player) {
 
-    int *board_copy = (int *)malloc(BOARDSIZE * sizeof(int));
+	struct Undo undo;
 	int black = 0;
 	int white = 0;
-	memset(board_copy, 0, BOARDSIZE);
 
-	for (int i = 0; i < BOARDSIZE; i++) {
-		board_copy[i] = board[i];
-	}
-
-	makemove(move, player);
+	undo = makemove(move, player);
 
-	black = count(BLACK, board);
-	white = count(WHITE, board);
+	black = count(BLACK);
+	white = count(WHITE);
 
-	for (int i = 0; i < BOARDSIZE; i++) {
-		board[i] = board_copy[i];
-	}
+	unmakemove(undo);
 
-	free(board_copy);
 	if (player == BLACK) {
 		return black - white;
 	} else {
@@ -842,38 +2285,63 @@ int potential_move_score(int move, int player) {
 
 }
 
-void makemove (int move, int player) {
-    int i;
-    board[move] = player;
-    for (i=0; i<=7; i++) makeflips(move, ALLDIRECTIONS[i], player);
+/*
+	Plays move for player. If player is not the side to move in board the
+	other side passed, so the masks are swapped first.
+ */
+struct Undo makemove (int move, int player) {
+    struct Undo undo;
+    uint64_t hash = hash_key;
+    int passed = board.colour != player;
+    if (passed) {
+        position_pass(&board);
+        hash_key ^= zobrist_white;
+    }
+    undo = play(move);
+    undo.hash = hash;
+    undo.passed = passed;
+    return undo;
 }
 
-void makeflips (int move, int dir, int player) {
-    int bracketer, c;
-    bracketer = wouldflip(move, dir, player);
-    if (bracketer) {
-        c = move + dir;
-        do {
-            board[c] = player;
-            c = c + dir;
-        } while (c != bracketer);
+/* makemove() for the side to move, which is all the search ever needs */
+struct Undo play(int move) {
+    struct Undo undo;
+    int colour = board.colour;
+    undo.move = move;
+    undo.hash = hash_key;
+    undo.passed = 0;
+    undo.flips = get_flips(move, board.player, board.opponent);
+    hash_key = zobrist_play(hash_key, colour, move, undo.flips);
+    position_play(&board, move, undo.flips);
+    undo.eval = eval_state;
+    pattern_place(&eval_state, colour, move);
+    for (uint64_t f = undo.flips; f; f &= f - 1) {
+        pattern_flip(&eval_state, colour, first_square(f));
     }
+    return undo;
+}
+
+void unmakemove (struct Undo undo) {
+    position_undo(&board, undo.move, undo.flips);
+    if (undo.passed) position_pass(&board);
+    hash_key = undo.hash;
+    eval_state = undo.eval;
 }
 
 void printboard(){
-    int row, col;
-    fprintf(fp,"   1 2 3 4 5 6 7 8 [%c=%d %c=%d]\n",
-            nameof(BLACK), count(BLACK, board), nameof(WHITE), count(WHITE, board));
-    for (row=1; row<=8; row++) {
-        fprintf(fp,"%d  ", row);
-        for (col=1; col<=8; col++)
-            fprintf(fp,"%c ", nameof(board[col + (10 * row)]));
-        fprintf(fp,"\n");
-		fflush(fp);
+    char text[10 * 20 + 40];
+    int row, col, len;
+
+    len = snprintf(text, sizeof(text), "   1 2 3 4 5 6 7 8 [%c=%d %c=%d]\n",
+            nameof(BLACK), count(BLACK), nameof(WHITE), count(WHITE));
+    for (row=0; row<8; row++) {
+        len += snprintf(text + len, sizeof(text) - len, "%d  ", row + 1);
+        for (col=0; col<8; col++)
+            len += snprintf(text + len, sizeof(text) - len, "%c ",
+                    nameof(piece_at(SQUARE(row, col))));
+        len += snprintf(text + len, sizeof(text) - len, "\n");
     }
-    fflush(fp);
-	fclose(fp);
-	fp = fopen("output.txt", "a");
+    log_info("%s", text);
 }
 
 
@@ -883,12 +2351,13 @@ char nameof (int piece) {
     return(piecenames[piece]);
 }
 
-int count (int player, int * board) {
-    int i, cnt;
-    cnt=0;
-    for (i=1; i<=88; i++)
-        if (board[i] == player) cnt++;
-    return cnt;
+int piece_at (int sq) {
+    if (board.player & BIT(sq)) return board.colour;
+    if (board.opponent & BIT(sq)) return opponent(board.colour);
+    return EMPTY;
 }
 
-
+int count (int player) {
+    if (board.colour == player) return popcount(board.player);
+    return popcount(board.opponent);
+}
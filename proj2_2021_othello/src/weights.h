@@ -0,0 +1,78 @@
+/* vim: ai:sw=4:ts=4:sts:et */
+
+/*H**********************************************************************
+ *
+ *	Evaluation weight file, written by the tuner (tune.c) and read by
+ *	the engines and tools at startup.
+ *
+ *	The file is a header followed by the disc weight of every stage and
+ *	then the [0] edge, corner and diagonal tables of pattern.h exactly as
+ *	they sit in memory, all int16. Loading it is a few freads and
+ *	pattern_swap_tables(); without a file the hand weights stay.
+ *H***********************************************************************/
+
+#ifndef WEIGHTS_H
+#define WEIGHTS_H
+
+#include<stdio.h>
+#include<stdint.h>
+
+#include "pattern.h"
+
+#define WEIGHTS_MAGIC 0x315448474945574FULL	/* "OWEIGHT1" */
+#define WEIGHTS_DEFAULT_PATH "player/weights.bin"
+
+struct WeightsHeader {
+	uint64_t magic;
+	uint32_t stages;		/* PATTERN_STAGES */
+	uint32_t edge;			/* EDGE_PATTERNS, also the diagonal tables */
+	uint32_t corner;		/* CORNER_PATTERNS */
+	uint32_t reserved;
+};
+
+static inline int weights_save(const char *path) {
+	struct WeightsHeader header = {WEIGHTS_MAGIC, PATTERN_STAGES, EDGE_PATTERNS, CORNER_PATTERNS, 0};
+	FILE *out = fopen(path, "wb");
+	int ok;
+
+	if (!out) {
+		return 0;
+	}
+	ok = fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(disc_weight, sizeof(disc_weight), 1, out) == 1
+		&& fwrite(edge_table[0], sizeof(edge_table[0]), 1, out) == 1
+		&& fwrite(corner_table[0], sizeof(corner_table[0]), 1, out) == 1
+		&& fwrite(diagonal_table[0], sizeof(diagonal_table[0]), 1, out) == 1;
+	return fclose(out) == 0 && ok;
+}
+
+/*
+	Replaces the tables with the ones in path. Returns 0, with the hand
+	weights back in place, if the file is missing, short or for other
+	table sizes. Call after pattern_init().
+ */
+static inline int weights_load(const char *path) {
+	struct WeightsHeader header;
+	FILE *in = fopen(path, "rb");
+	int ok;
+
+	if (!in) {
+		return 0;
+	}
+	ok = fread(&header, sizeof(header), 1, in) == 1
+		&& header.magic == WEIGHTS_MAGIC && header.stages == PATTERN_STAGES
+		&& header.edge == EDGE_PATTERNS && header.corner == CORNER_PATTERNS
+		&& fread(disc_weight, sizeof(disc_weight), 1, in) == 1
+		&& fread(edge_table[0], sizeof(edge_table[0]), 1, in) == 1
+		&& fread(corner_table[0], sizeof(corner_table[0]), 1, in) == 1
+		&& fread(diagonal_table[0], sizeof(diagonal_table[0]), 1, in) == 1;
+	fclose(in);
+	if (!ok) {
+		pattern_init();
+		return 0;
+	}
+	pattern_swap_tables();
+	return 1;
+}
+
+#endif